@@ -4,6 +4,9 @@ import math
 from random import randint
 from multiprocessing import Process, Queue
 import sys
+import os
+import mmap
+import struct
 
 def ModInverse(a, n):
 	""" Calculates the modular inverse of a mod n.
@@ -119,6 +122,37 @@ def nPrime(n):
 	nPrime = (r * rInverse -1) // n
 	return (r, nPrime)
 
+def read_binary(filename):
+	""" Read a binary dataset written with --format binary (see src/dataset.h).
+		The file is mmapped, and the columns are read without parsing text.
+		Returns (n, e, data) like the CSV reader.
+	"""
+	with open(filename, 'rb') as f:
+		m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+	if m[0:8] != b'RSATIME\0':
+		raise ValueError(filename + " is not a dataset file")
+	version, words, keyBits, limbs, count, messageOffset, signatureOffset, durationOffset, capacity = struct.unpack_from('<IIIIQQQQQ', m, 8)
+	rowBytes = 8 * words
+	def number(offset):
+		value = 0
+		for w in reversed(struct.unpack_from('<%dQ' % words, m, offset)):
+			value = (value << 64) | w
+		return value
+	keys = 64 if version == 1 else 128 # version 2 adds the timer fields
+	n = number(keys)
+	e = number(keys + rowBytes)
+	durations = struct.unpack_from('<%dq' % count, m, durationOffset)
+	data = [[number(messageOffset + i * rowBytes), number(signatureOffset + i * rowBytes), durations[i]] for i in range(count)]
+	if version >= 2:
+		minOffset, madOffset = struct.unpack_from('<QQ', m, 88)
+		if minOffset and madOffset: # --repeat: the duration is the median, add the min and mad columns
+			mins = struct.unpack_from('<%dq' % count, m, minOffset)
+			mads = struct.unpack_from('<%dq' % count, m, madOffset)
+			for i in range(count):
+				data[i] += [mins[i], mads[i]]
+	m.close()
+	return (n, e, data)
+
 def RSAAttack(n,data, ratio):
 
 	""" Attempt to recover the private key from a data set. The public key is konwn, i.e. we know 
@@ -180,17 +214,20 @@ if __name__ == "__main__":
 		path = 'output/2ms_sleep_33bit_key'
 		difference = 4500000
 		print "usage: python RSAAttack.py <path/to/dataset> <difference>"
-		print "the data should be in a file called data.csv, in the path given."
+		print "the data should be in a file called data.csv (or data.bin), in the path given."
 		print " <difference> is the difference in nanoseconds between trueSet and falseSet required to guess that the bit is 1."
 		print "using defaults:", path, difference
 	
-	with open(path+'/data.csv', 'rb') as f:
-		_ = f.readline() # Ignore first line (which is a column description)
-		n, e = f.readline().split(',') # read in public key
-		n = int(n)
-		e = int(e)
-		_=f.readline() # ignore third line (which is a column description)
-		data = [[int(x) for x in line.split(',')] for line in f] # read in signature data.
+	if os.path.exists(path+'/data.bin'):
+		n, e, data = read_binary(path+'/data.bin')
+	else:
+		with open(path+'/data.csv', 'rb') as f:
+			_ = f.readline() # Ignore first line (which is a column description)
+			n, e = f.readline().split(',') # read in public key
+			n = int(n)
+			e = int(e)
+			_=f.readline() # ignore third line (which is a column description)
+			data = [[int(x) for x in line.split(',')] for line in f] # read in signature data.
 	# n = 97*103
 	# n = 1970929544600547009951195551285008926853396879274216401752268706841404681558486301260625047332466057195397288315196808109669482273081696371319566859742602315869521815253148612244617512958426682609530067
 	print "n: ", n, "difference cutoff: ", difference, "path:", path
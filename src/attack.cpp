@@ -0,0 +1,622 @@
+//
+//  attack.cpp
+//  rsa
+//
+//  Timing attack on the Montgomery multiplication, the native counterpart
+//  of Attack/RSAAttack.py.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "rsa.h"
+#include "dataset.h"
+#include "threadpool.h"
+#include "tuning.h"
+
+/*
+ * One signature from the dataset.
+ * subtractions is the step 4 subtraction count the signer recorded when it
+ * was built with RSA_STATS, or -1 if the dataset has no operation counts.
+ */
+template<ttmath::uint Limbs>
+struct Sample {
+    ttmath::UInt<Limbs> message;
+    ttmath::UInt<Limbs> signature;
+    int64_t duration;
+    int64_t subtractions;
+};
+
+/*
+ * Command line options.
+ */
+struct Options {
+    std::string path;   // directory with data.bin or data.csv
+    double difference;  // ns between the bucket averages to guess a 1, 0 to compare t statistics
+    int threads;        // worker threads, 0 for one per core
+    size_t datEvery;    // write every datEvery-th sample to the .dat files, 0 for none
+    bool simd;          // use the batch Montgomery kernel when the CPU has AVX-512 IFMA
+    double minT;        // |t1 - t0| the adaptive guess needs to accept a bit, 0 accepts any
+};
+
+
+/*
+ * True if the line holds no digits, i.e. is empty or a column description.
+ */
+static bool isHeaderLine(const std::string &line){
+    for (char c : line) {
+        if (c >= '0' && c <= '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Splits a CSV line on commas.
+ */
+static std::vector<std::string> splitLine(const std::string &line){
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t comma = line.find(',', start);
+        fields.push_back(line.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (comma == std::string::npos) {
+            return fields;
+        }
+        start = comma + 1;
+    }
+}
+
+/*
+ * Reads the public key line of a data.csv: the first line with digits.
+ */
+static bool readCsvKey(std::istream &in, std::string &n, std::string &e){
+    std::string line;
+    while (std::getline(in, line)) {
+        if (isHeaderLine(line)) {
+            continue;
+        }
+        std::vector<std::string> fields = splitLine(line);
+        if (fields.size() < 2) {
+            return false;
+        }
+        n = fields[0];
+        e = fields[1];
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Reads data.csv as written by csv, or by RSAAttack.py's reference datasets.
+ */
+template<ttmath::uint Limbs>
+bool readCsv(const std::string &file, ttmath::UInt<Limbs> &n, ttmath::UInt<Limbs> &e,
+             std::vector<Sample<Limbs> > &samples){
+    std::ifstream in(file.c_str());
+    std::string nText, eText, line;
+    if (!in || !readCsvKey(in, nText, eText)) {
+        printf("Could not read the public key from %s\n", file.c_str());
+        return false;
+    }
+    n.FromString(nText);
+    e.FromString(eText);
+    size_t subtractionsColumn = 0;  // 0 if there is none, the message is column 0
+    while (std::getline(in, line)) {
+        if (isHeaderLine(line)) {
+            std::vector<std::string> names = splitLine(line);
+            for (size_t c = 0; c < names.size(); c++) {
+                if (names[c] == "subtractions") {
+                    subtractionsColumn = c;
+                }
+            }
+            continue;
+        }
+        std::vector<std::string> fields = splitLine(line);
+        if (fields.size() < 3) {
+            printf("Skipping malformed line: %s\n", line.c_str());
+            continue;
+        }
+        Sample<Limbs> sample;
+        sample.message.FromString(fields[0]);
+        sample.signature.FromString(fields[1]);
+        sample.duration = strtoll(fields[2].c_str(), NULL, 10);
+        sample.subtractions = -1;
+        if (subtractionsColumn && subtractionsColumn < fields.size()) {
+            sample.subtractions = strtoll(fields[subtractionsColumn].c_str(), NULL, 10);
+        }
+        samples.push_back(sample);
+    }
+    return true;
+}
+
+/*
+ * Reads data.bin, see dataset.h.
+ */
+template<ttmath::uint Limbs>
+bool readBinary(const std::string &file, ttmath::UInt<Limbs> &n, ttmath::UInt<Limbs> &e,
+                std::vector<Sample<Limbs> > &samples){
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    dataset::Header h;
+    if (!in || !dataset::readHeader(in, h)) {
+        return false;
+    }
+    const uint64_t rowBytes = 8 * uint64_t(h.words);
+    std::vector<unsigned char> words(rowBytes);
+    for (uint32_t i = 0; i < h.words; i++) dataset::put64(&words[8*i], h.n[i]);
+    dataset::getNum(&words[0], h.words, n);
+    for (uint32_t i = 0; i < h.words; i++) dataset::put64(&words[8*i], h.e[i]);
+    dataset::getNum(&words[0], h.words, e);
+
+    std::vector<unsigned char> messages(h.count * rowBytes), signatures(h.count * rowBytes), durations(h.count * 8);
+    in.seekg(h.messageOffset);
+    in.read((char*)messages.data(), messages.size());
+    in.seekg(h.signatureOffset);
+    in.read((char*)signatures.data(), signatures.size());
+    in.seekg(h.durationOffset);
+    in.read((char*)durations.data(), durations.size());
+    std::vector<unsigned char> subtractions(h.statsOffset ? h.count * 8 : 0);
+    if (h.statsOffset) {
+        in.seekg(dataset::statsColumnOffset(h, 2));     // see dataset::StatsColumnNames
+        in.read((char*)subtractions.data(), subtractions.size());
+    }
+    if (!in) {
+        printf("Truncated dataset %s\n", file.c_str());
+        return false;
+    }
+    samples.resize(h.count);
+    for (uint64_t i = 0; i < h.count; i++) {
+        dataset::getNum(&messages[i * rowBytes], h.words, samples[i].message);
+        dataset::getNum(&signatures[i * rowBytes], h.words, samples[i].signature);
+        samples[i].duration = (int64_t)dataset::get64(&durations[8*i]);
+        samples[i].subtractions = h.statsOffset ? (int64_t)dataset::get64(&subtractions[8*i]) : -1;
+    }
+    return true;
+}
+
+static bool fileExists(const std::string &file){
+    std::ifstream in(file.c_str());
+    return bool(in);
+}
+
+
+/*
+ * Running count, mean and variance of a set of durations (Welford).
+ * Every worker keeps its own, and they are merged once per bit.
+ */
+struct RunningStats {
+    uint64_t count;
+    double mean, m2;    // m2 is the sum of squared differences from the mean
+
+    RunningStats():count(0),mean(0),m2(0){}
+
+    void add(double x){
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    /*
+     * Adds the values of other (Chan et al.'s parallel update).
+     */
+    void merge(const RunningStats &other){
+        if (other.count == 0) {
+            return;
+        }
+        uint64_t total = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * (double(count) * other.count / total);
+        count = total;
+    }
+
+    double variance() const {
+        return count > 1 ? m2 / (count - 1) : 0;
+    }
+};
+
+/*
+ * Welch's t statistic for the means of a and b differing.
+ * Positive when a is slower.
+ */
+static double welchT(const RunningStats &a, const RunningStats &b){
+    double se = sqrt(a.variance() / a.count + b.variance() / b.count);
+    return se > 0 ? (a.mean - b.mean) / se : 0;
+}
+
+/*
+ * What one worker found for one bit: the statistics of the two sets, and
+ * the samples picked for the .dat file. Aligned so workers don't share cache lines.
+ */
+struct alignas(64) WorkerSplit {
+    RunningStats sets[2];   // [0] needed the step 4 subtraction, [1] did not
+    RunningStats squares[2][2]; // the same for the next squaring, if the bit is [0] or [1]
+    std::vector<std::pair<size_t, bool> > sampled;
+};
+
+/*
+ * True if every sample has the subtraction count recorded by the signer.
+ */
+template<ttmath::uint Limbs>
+static bool hasGroundTruth(const std::vector<Sample<Limbs> > &samples){
+    for (auto &sample : samples) {
+        if (sample.subtractions < 0) {
+            return false;
+        }
+    }
+    return !samples.empty();
+}
+
+/*
+ * Least squares fit of the durations on the recorded subtraction counts.
+ * The slope is what one subtraction costs, so a bit that is 1 should split
+ * the sets by about that much, and half of it is a starting difference cutoff.
+ */
+template<ttmath::uint Limbs>
+static void printGroundTruthFit(const std::vector<Sample<Limbs> > &samples){
+    RunningStats x, y;
+    double cxy = 0;
+    for (auto &sample : samples) {
+        const double dx = double(sample.subtractions) - x.mean;
+        x.add(double(sample.subtractions));
+        y.add(double(sample.duration));
+        cxy += dx * (double(sample.duration) - y.mean);
+    }
+    const double slope = x.m2 > 0 ? cxy / x.m2 : 0;
+    const double r = (x.m2 > 0 && y.m2 > 0) ? cxy / sqrt(x.m2 * y.m2) : 0;
+    printf("Recorded subtractions: mean %g, %g ns each (r = %g), try a difference of about %g\n",
+           x.mean, slope, r, slope / 2);
+}
+
+/*
+ * Counts the samples whose recorded subtractions are those a ModExp or
+ * ModExpSleep signer with private exponent d makes, the conversion of the
+ * message into Montgomery form included. Checks that the attack's model of
+ * the server, which makes its splits, matches what the server did.
+ */
+template<ttmath::uint Limbs>
+static size_t matchGroundTruth(const std::vector<Sample<Limbs> > &samples, const ttmath::UInt<Limbs> &d,
+                               const MontgomeryContext<Limbs> &ctx, ThreadPool &pool){
+    typedef Rsa<Limbs> RsaN;
+    std::vector<size_t> matches(pool.size(), 0);
+    pool.parallelFor(samples.size(), [&](size_t begin, size_t end, int worker){
+        typename RsaN::num u;
+        long subtractions;
+        for (size_t i = begin; i < end; i++) {
+            RsaN::ModExpCount(samples[i].message, d, ctx, subtractions);
+            subtractions += RsaN::MontgomeryKernel(samples[i].message, ctx.r2ModN, ctx, u);
+            matches[worker] += (subtractions == samples[i].subtractions);
+        }
+    });
+    size_t total = 0;
+    for (size_t m : matches) {
+        total += m;
+    }
+    return total;
+}
+
+/*
+ * Writes the sampled split for one bit to path/NNNN.dat, for plotting.
+ * step4 is 1 for the messages that needed the subtraction, 2 for the others.
+ */
+template<ttmath::uint Limbs>
+void writeSplit(const Options &opts, long bit, const std::vector<Sample<Limbs> > &samples,
+                const std::vector<WorkerSplit> &splits){
+    char name[16];
+    snprintf(name, sizeof(name), "/%04ld.dat", bit);
+    std::ofstream f((opts.path + name).c_str());
+    f << "message,signature,duration,step4\n";
+    for (int set = 0; set < 2; set++) {
+        for (auto &split : splits) {
+            for (auto &entry : split.sampled) {
+                if (entry.second == (set == 0)) {
+                    const Sample<Limbs> &sample = samples[entry.first];
+                    f << sample.message << "," << sample.signature << "," << sample.duration << "," << set + 1 << "\n";
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Recovers the private exponent one bit at a time, from the most significant.
+ * For every bit the samples are split on whether the multiplication for that
+ * bit, if it were 1, needs the step 4 subtraction. If the bit is 1 the server
+ * made that subtraction, and the split shows up in the average durations.
+ *
+ * Every sample keeps its ModExp state after the bits recovered so far, so a bit
+ * costs one square and one multiplication per sample, instead of replaying
+ * the exponentiation from the first bit like rsa_sim in RSAAttack.py.
+ * The sets are only kept as running statistics, so the memory used does
+ * not grow with the number of bits.
+ *
+ * With AVX-512 IFMA the states are kept BatchLanes samples to a batch, and
+ * every product is a batch product. The subtractions are the same.
+ */
+template<ttmath::uint Limbs>
+int attack(const Options &opts, const ttmath::UInt<Limbs> &n, const ttmath::UInt<Limbs> &e,
+           const std::vector<Sample<Limbs> > &samples){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    if (samples.size() < 2) {
+        printf("Need at least two signatures\n");
+        return 1;
+    }
+    if (opts.difference > 0) {
+        std::cout << "n: " << n << " difference cutoff: " << opts.difference << " path: " << opts.path << std::endl;
+    }
+    else {
+        std::cout << "n: " << n << " no cutoff, comparing t statistics" << " path: " << opts.path << std::endl;
+    }
+
+    RsaN rsa(n, e);
+    const MontgomeryContext<Limbs> ctx(n);
+    ThreadPool pool(opts.threads);
+    printf("%lu signatures, %d threads\n", (unsigned long)samples.size(), pool.size());
+
+    const bool batch = opts.simd && RsaN::BatchAvailable();
+    const int lanes = RsaN::Batch::Lanes;
+    const typename RsaN::BatchCtx bctx(ctx);
+    printf("%s Montgomery products\n", batch ? "AVX-512 IFMA batch" : "Scalar");
+    const bool groundTruth = hasGroundTruth(samples);
+    if (groundTruth) {
+        printGroundTruthFit(samples);
+    }
+
+    std::vector<WorkerSplit> splits(pool.size());
+    std::vector<typename RsaN::State> states(batch ? 0 : samples.size());
+    std::vector<typename RsaN::BatchState> batches(batch ? (samples.size() + lanes - 1) / lanes : 0);
+    num key = 1; // Assume the first bit of the key is 1
+    pool.parallelFor(batch ? batches.size() : samples.size(), [&](size_t begin, size_t end, int){
+        for (size_t i = begin; i < end; i++) {
+            if (batch) {
+                num messages[lanes];
+                const size_t first = i * lanes, count = std::min<size_t>(lanes, samples.size() - first);
+                for (size_t l = 0; l < count; l++) {
+                    messages[l] = samples[first + l].message;
+                }
+                RsaN::ModExpBatchBegin(messages, int(count), bctx, batches[i]);
+                RsaN::ModExpBatchStep(batches[i], true, bctx);
+            }
+            else {
+                RsaN::ModExpBegin(samples[i].message, ctx, states[i]);
+                RsaN::ModExpStep(states[i], true, ctx);
+            }
+        }
+    });
+    const long maxBits = RsaN::numBits(n);
+    for (long bit = 1; bit < maxBits; bit++) {
+        // Split the samples on the subtraction for the next bit being 1,
+        // after moving every state past the bit guessed last time.
+        const bool advance = bit > 1;
+        const bool last = key.GetBit(0);
+        const bool adaptive = opts.difference <= 0;
+        pool.parallelFor(batch ? batches.size() : samples.size(), [&](size_t begin, size_t end, int worker){
+            WorkerSplit &split = splits[worker];
+            split = WorkerSplit();
+            // Adds sample i to the sets, squares[h] tells the subtraction of the next squaring if the bit is h
+            auto record = [&](size_t i, bool subtraction, const bool squares[2]){
+                split.sets[subtraction ? 0 : 1].add(double(samples[i].duration));
+                if (adaptive) {
+                    for (int h = 0; h < 2; h++) {
+                        split.squares[h][squares[h] ? 0 : 1].add(double(samples[i].duration));
+                    }
+                }
+                if (opts.datEvery > 0 && i % opts.datEvery == 0) {
+                    split.sampled.push_back(std::make_pair(i, subtraction));
+                }
+            };
+            num scratch;
+            typename RsaN::Batch batchScratch;
+            bool squares[2] = {false, false};
+            for (size_t i = begin; i < end; i++) {
+                if (batch) {
+                    typename RsaN::BatchState &state = batches[i];
+                    if (advance) {
+                        RsaN::ModExpBatchCommit(state, last);
+                    }
+                    const unsigned subtractions = RsaN::ModExpBatchTry(state, bctx);
+                    unsigned squareSubtractions[2] = {0, 0};
+                    if (adaptive) {
+                        squareSubtractions[0] = RsaN::MontgomeryBatch(state.square, state.square, bctx, batchScratch);
+                        squareSubtractions[1] = RsaN::MontgomeryBatch(state.product, state.product, bctx, batchScratch);
+                    }
+                    const size_t first = i * lanes, count = std::min<size_t>(lanes, samples.size() - first);
+                    for (size_t l = 0; l < count; l++) {
+                        squares[0] = (squareSubtractions[0] >> l) & 1;
+                        squares[1] = (squareSubtractions[1] >> l) & 1;
+                        record(first + l, (subtractions >> l) & 1, squares);
+                    }
+                    continue;
+                }
+                if (advance) {
+                    RsaN::ModExpCommit(states[i], last);
+                }
+                const bool subtraction = RsaN::ModExpTry(states[i], ctx);
+                if (adaptive) {
+                    for (int h = 0; h < 2; h++) {
+                        const num &x_bar = h ? states[i].product : states[i].square;
+                        squares[h] = RsaN::MontgomeryKernel(x_bar, x_bar, ctx, scratch);
+                    }
+                }
+                record(i, subtraction, squares);
+            }
+        });
+        if (opts.datEvery > 0) {
+            writeSplit(opts, bit, samples, splits);
+        }
+
+        // Average signing time of each set
+        RunningStats sets[2], squares[2][2];
+        for (auto &split : splits) {
+            for (int s = 0; s < 2; s++) {
+                sets[s].merge(split.sets[s]);
+                squares[0][s].merge(split.squares[0][s]);
+                squares[1][s].merge(split.squares[1][s]);
+            }
+        }
+        const bool empty = sets[0].count == 0 || sets[1].count == 0;
+        if (empty) {
+            printf("One of the sets is empty, guessing next bit is 0.\n");
+        }
+        const double difference = fabs(sets[0].mean - sets[1].mean);
+        const double t = empty ? 0 : welchT(sets[0], sets[1]);
+        printf("Ratio: \t%g \tDifference: %g \tt: %g \t(%llu/%llu)\n", sets[1].mean ? sets[0].mean / sets[1].mean : 0,
+               difference, t, (unsigned long long)sets[0].count, (unsigned long long)sets[1].count);
+
+        // Guess the bit from the difference between the average times, or
+        // without a cutoff, from which guess explains the next squaring better:
+        // only the right guess splits the samples into a slow and a fast set.
+        bool one;
+        if (adaptive) {
+            const double t0 = welchT(squares[0][0], squares[0][1]);
+            const double t1 = welchT(squares[1][0], squares[1][1]);
+            printf("Next squaring t if the bit is 0: %g, if it is 1: %g\n", t0, t1);
+            // Only the right guess splits the squaring, so a small gap means
+            // neither does, and every bit after a wrong guess would be wrong too.
+            if (empty || fabs(t1 - t0) < opts.minT) {
+                printf("Bit %ld is undecided, |t1 - t0| = %g is below %g. Stopping, with the first %ld bits:\n",
+                       bit, fabs(t1 - t0), opts.minT, bit);
+                std::cout << key.ToString(2) << std::endl;
+                printf("Try more signatures or less noise, or a lower --min-t.\n");
+                return 1;
+            }
+            one = t1 > t0;
+        }
+        else {
+            one = !empty && difference > opts.difference;
+        }
+        key.Rcl(1, one ? 1 : 0);
+        printf("Guessing next bit is %d.\n", one ? 1 : 0);
+        std::cout << "Derived key: " << key.ToString(2) << std::endl;
+
+        // Check if we found the correct key, or should continue. The other
+        // value of the bit is tried as well, since no squaring follows the
+        // last bit to decide it with.
+        for (int flip = 0; flip < 2; flip++) {
+            num guess = key;
+            if (flip) {
+                guess.table[0] ^= 1;
+            }
+            rsa.setPrivateExponent(guess);
+            if (rsa.sign(samples[0].message) == samples[0].signature && rsa.sign(samples[1].message) == samples[1].signature) {
+                std::cout << "Guessed Correctly! Private key is: \t" << guess << std::endl;
+                if (groundTruth) {
+                    printf("The subtractions of the key match the recorded ones for %lu of %lu signatures\n",
+                           (unsigned long)matchGroundTruth(samples, guess, ctx, pool), (unsigned long)samples.size());
+                }
+                return 0;
+            }
+        }
+    }
+    printf("Could not recover the key. Try another cutoff, or more signatures.\n");
+    return 1;
+}
+
+/*
+ * Loads the dataset into nums of the given size and runs the attack.
+ */
+template<ttmath::uint Limbs>
+int run(const Options &opts){
+    ttmath::UInt<Limbs> n, e;
+    std::vector<Sample<Limbs> > samples;
+    const std::string bin = opts.path + "/data.bin";
+    bool ok = fileExists(bin) ? readBinary(bin, n, e, samples)
+                              : readCsv(opts.path + "/data.csv", n, e, samples);
+    if (!ok) {
+        return 1;
+    }
+    return attack(opts, n, e, samples);
+}
+
+/*
+ * Bits in the modulus of the dataset, to pick the size of the nums.
+ */
+static long modulusBits(const Options &opts){
+    const std::string bin = opts.path + "/data.bin";
+    if (fileExists(bin)) {
+        std::ifstream in(bin.c_str(), std::ios::in | std::ios::binary);
+        dataset::Header h;
+        return dataset::readHeader(in, h) ? long(h.keyBits) : -1;
+    }
+    std::ifstream in((opts.path + "/data.csv").c_str());
+    std::string nText, eText;
+    if (!in || !readCsvKey(in, nText, eText)) {
+        printf("Could not read %s/data.csv\n", opts.path.c_str());
+        return -1;
+    }
+    ttmath::UInt<RSA_LIMBS(4096)> n;
+    if (n.FromString(nText)) {
+        printf("The modulus is larger than 4096 bits\n");
+        return -1;
+    }
+    return Rsa<RSA_LIMBS(4096)>::numBits(n);
+}
+
+void usage(){
+    printf("Usage: ./attack <path/to/dataset> [difference] [options]\n");
+    printf("Recovers the private key from the timings in path/data.bin or path/data.csv.\n");
+    printf("[difference] is the difference in nanoseconds between the two sets\n");
+    printf("required to guess that the bit is 1. Without it, both guesses are tried on\n");
+    printf("the squaring that follows the bit, and the one whose split has the larger\n");
+    printf("Welch t statistic wins, as long as the two t statistics differ by --min-t.\n");
+    printf("Options:\n");
+    printf("  --threads <n>                worker threads (default: one per core)\n");
+    printf("  --dat <k>                    write every k-th signature of each split to NNNN.dat\n");
+    printf("  --no-simd                    scalar Montgomery products even with AVX-512 IFMA\n");
+    printf("  --min-t <t>                  stop at the first bit whose two t statistics differ by less\n");
+    printf("                               than t, without a difference (default 4, 0 never stops)\n");
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    Options opts;
+    opts.path = argv[1];
+    opts.difference = 0;
+    opts.threads = 0;
+    opts.datEvery = 0;
+    opts.simd = true;
+    opts.minT = 4;
+    int i = 2;
+    if (i < argc && argv[i][0] != '-') {
+        opts.difference = atof(argv[i++]);
+    }
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--dat") && i + 1 < argc) {
+            opts.datEvery = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--no-simd")) {
+            opts.simd = false;
+        }
+        else if (!strcmp(argv[i], "--min-t") && i + 1 < argc) {
+            opts.minT = atof(argv[++i]);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    const long bits = modulusBits(opts);
+    if (bits < 0) {
+        return 1;
+    }
+    loadTuning();
+    // Pick the smallest instantiation that holds the modulus.
+    if (bits <= 512) return run<RSA_LIMBS(512)>(opts);
+    if (bits <= 1024) return run<RSA_LIMBS(1024)>(opts);
+    if (bits <= 2048) return run<RSA_LIMBS(2048)>(opts);
+    return run<RSA_LIMBS(4096)>(opts);
+}
@@ -0,0 +1,395 @@
+//
+//  bench.cpp
+//  rsa
+//
+//  Microbenchmarks of the Rsa math and the ttmath kernels under it.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "rsa.h"
+#include "random.h"
+#include "timer.h"
+#include "tuning.h"
+
+/*
+ * Command line options.
+ */
+struct Options {
+    std::vector<long> bits;     // operand sizes, all of 512..4096 if empty
+    std::string filter;         // only benchmarks whose name contains this
+    int runs;                   // timed runs of every benchmark
+    double minTime;             // ms a run takes at least, sets the iterations per run
+    TimerSource timer;
+    const char *json;           // file for the JSON results, "-" for stdout, NULL for none
+    const char *tune;           // measure the Karatsuba limits and write them here, NULL to read them
+    FILE *log;                  // the table, stderr when the JSON goes to stdout
+};
+
+/*
+ * Timings of one benchmark, in ns per operation over the runs.
+ */
+struct Result {
+    std::string name;
+    long bits;
+    uint64_t iterations;    // operations per run
+    double median, min, max, mad;
+};
+
+/*
+ * Makes the compiler assume x is read and written here, so the benchmarked
+ * code is neither removed nor hoisted out of the loop.
+ */
+template<class T>
+static inline void keep(T &x){
+    asm volatile("" : : "r"(&x) : "memory");
+}
+
+static double median(std::vector<double> v){
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/*
+ * Times f: finds the iterations that make a run take opts.minTime, which
+ * also warms up the caches, and then times opts.runs runs.
+ */
+template<class F>
+static Result measure(const char *name, long bits, const Options &opts, const Timer &timer, F f){
+    Result result;
+    result.name = name;
+    result.bits = bits;
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t begin = timer.start();
+        for (uint64_t i = 0; i < iterations; i++) {
+            f();
+        }
+        uint64_t end = timer.stop();
+        const double ms = timer.elapsed(begin, end).count() / 1e6;
+        if (ms >= opts.minTime || iterations >= (uint64_t(1) << 30)) {
+            break;
+        }
+        // aim a little over minTime, at most 10 times the iterations per step
+        iterations = ms > 0 ? std::max(iterations + 1, std::min(iterations * 10, uint64_t(iterations * 1.2 * opts.minTime / ms)))
+                            : iterations * 10;
+    }
+    result.iterations = iterations;
+
+    std::vector<double> perOp(opts.runs);
+    for (auto &ns : perOp) {
+        uint64_t begin = timer.start();
+        for (uint64_t i = 0; i < iterations; i++) {
+            f();
+        }
+        uint64_t end = timer.stop();
+        ns = double(timer.elapsed(begin, end).count()) / iterations;
+    }
+    result.median = median(perOp);
+    result.min = *std::min_element(perOp.begin(), perOp.end());
+    result.max = *std::max_element(perOp.begin(), perOp.end());
+    std::vector<double> deviations(perOp);
+    for (auto &d : deviations) {
+        d = fabs(d - result.median);
+    }
+    result.mad = median(deviations);
+    return result;
+}
+
+/*
+ * Cycles for ns nanoseconds, or -1 if the timer does not count cycles.
+ * The TSC counts reference cycles, the ARM virtual counter a fixed
+ * frequency that is not the core clock.
+ */
+static double cycles(const Timer &timer, double ns){
+    return timer.source == TIMER_TSC ? ns / timer.nsPerTick : -1;
+}
+
+static void print(const Options &opts, const Timer &timer, const Result &r){
+    const double c = cycles(timer, r.median);
+    fprintf(opts.log, "%-21s %5ld %14.1f ns", r.name.c_str(), r.bits, r.median);
+    if (c >= 0) {
+        fprintf(opts.log, " %14.0f cycles", c);
+    }
+    fprintf(opts.log, "  mad %5.2f%%  [%.1f, %.1f]  %llu/run\n", r.median > 0 ? 100 * r.mad / r.median : 0,
+            r.min, r.max, (unsigned long long)r.iterations);
+    fflush(opts.log);
+}
+
+/*
+ * Benchmarks of one operand size. The operands come from a fixed seed, so
+ * every host times the same numbers.
+ */
+template<ttmath::uint Limbs>
+static void benchSize(long bits, const Options &opts, const Timer &timer, std::vector<Result> &results){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    typedef typename RsaN::numWide numWide;
+
+    Xoshiro256 rng(bits);
+    num n = bigrand(num(0), rng);   // bits is the width of num
+    n.SetBit(bits - 1);
+    n.SetBit(0);
+    num d = bigrand(n, rng);
+    d.SetBit(bits - 1);     // a full length exponent
+    num a = bigrand(n, rng), b = bigrand(n, rng), out;
+    const typename RsaN::Context ctx(n);
+    numWide wide, dividend, divisor = n, quotient, remainder, r;
+    dividend.SetZero();
+    a.MulBig(b, dividend);
+    // A CRT key of two odd half size factors, the timing does not depend on
+    // them being prime. d is set afterwards, it has no inverse to come from.
+    num half = 1, p, q;
+    half.Rcl(bits / 2);
+    p = bigrand(half, rng);
+    q = bigrand(half, rng);
+    p.SetBit(bits / 2 - 1);
+    p.SetBit(0);
+    q.SetBit(bits / 2 - 1);
+    q.SetBit(0);
+    RsaN crt(p, q, 65537);
+    crt.setPrivateExponent(d);
+    RsaN crtThreads = crt;
+    crtThreads.setCrtThreads(true);
+    long count = 0;
+    keep(a);
+    keep(b);
+    keep(d);
+
+    auto run = [&](const char *name, std::function<void()> f){
+        if (opts.filter.empty() || std::string(name).find(opts.filter) != std::string::npos) {
+            results.push_back(measure(name, bits, opts, timer, f));
+            print(opts, timer, results.back());
+        }
+    };
+    run("MontgomeryProduct", [&]{ out = RsaN::MontgomeryProduct(a, b, ctx); keep(out); });
+    run("ModExp", [&]{ out = RsaN::ModExp(a, d, ctx); keep(out); });
+    run("ModExpPublic", [&]{ out = RsaN::ModExpPublic(a, 65537, ctx); keep(out); });
+    run("decryptCrt", [&]{ out = crt.decryptCrt(a); keep(out); });
+    run("decryptCrtThreads", [&]{ out = crtThreads.decryptCrt(a); keep(out); });
+    run("PoweringLadder", [&]{ out = RsaN::PoweringLadder(a, d, ctx); keep(out); });
+    run("PoweringLadderBarrett", [&]{ out = RsaN::PoweringLadderBarrett(a, d, ctx); keep(out); });
+    run("Reduce", [&]{ out = RsaN::Reduce(dividend, n); keep(out); });
+    run("BarrettReduce", [&]{ out = RsaN::BarrettReduce(dividend, ctx.barrett); keep(out); });
+    run("ModInverse", [&]{ out = RsaN::ModInverse(a, n); keep(out); });
+    run("nPrime", [&]{ RsaN::nPrime(n, r, out); keep(out); });
+    run("numBits", [&]{ count += RsaN::numBits(a); keep(count); });
+    run("Mul1Big", [&]{ a.Mul1Big(b, wide); keep(wide); });
+    run("Mul2Big", [&]{ a.Mul2Big(b, wide); keep(wide); });
+    run("Mul3Big", [&]{ a.Mul3Big(b, wide); keep(wide); });
+    run("Div1", [&]{ quotient = dividend; quotient.Div1(divisor, remainder); keep(quotient); });
+    run("Div2", [&]{ quotient = dividend; quotient.Div2(divisor, remainder); keep(quotient); });
+    run("Div3", [&]{ quotient = dividend; quotient.Div3(divisor, remainder); keep(quotient); });
+}
+
+/*
+ * Time of a Karatsuba multiplication, or squaring, split at the top and
+ * schoolbook below, against the schoolbook one on the same S limb numbers.
+ */
+struct Crossover {
+    ttmath::uint size;
+    double schoolbook, karatsuba;   // ns per operation, fastest run
+};
+
+template<ttmath::uint S>
+static void crossover(bool square, const Options &opts, const Timer &timer, std::vector<Crossover> &out){
+    Xoshiro256 rng(S);
+    ttmath::UInt<S> a = bigrand(ttmath::UInt<S>(0), rng), b = bigrand(ttmath::UInt<S>(0), rng);
+    ttmath::UInt<2*S> wide;
+    keep(a);
+    keep(b);
+    ttmath::uint &limit = square ? ttmath::KaratsubaSquaringFromSize() : ttmath::KaratsubaMultiplicationFromSize();
+    auto f = [&]{
+        if (square) {
+            a.Sqr3Big(wide);
+        }
+        else {
+            a.Mul3Big(b, wide);
+        }
+        keep(wide);
+    };
+    Crossover c;
+    c.size = S;
+    limit = S + 1;
+    c.schoolbook = measure("", 0, opts, timer, f).min;
+    limit = S;
+    c.karatsuba = measure("", 0, opts, timer, f).min;
+    out.push_back(c);
+}
+
+/*
+ * Sets one Karatsuba limit to the smallest measured size from which the
+ * Karatsuba split is faster at every larger size, and prints the timings.
+ */
+static void tuneLimit(bool square, const Options &opts, const Timer &timer){
+    std::vector<Crossover> sizes;
+    crossover<4>(square, opts, timer, sizes);
+    crossover<6>(square, opts, timer, sizes);
+    crossover<8>(square, opts, timer, sizes);
+    crossover<12>(square, opts, timer, sizes);
+    crossover<16>(square, opts, timer, sizes);
+    crossover<24>(square, opts, timer, sizes);
+    crossover<32>(square, opts, timer, sizes);
+    crossover<48>(square, opts, timer, sizes);
+    crossover<64>(square, opts, timer, sizes);
+    ttmath::uint limit = sizes.back().size + 1;
+    for (size_t i = sizes.size(); i > 0 && sizes[i-1].karatsuba < sizes[i-1].schoolbook; i--) {
+        limit = sizes[i-1].size;
+    }
+    for (auto &c : sizes) {
+        fprintf(opts.log, "%-14s %3lu limbs  schoolbook %10.1f ns  Karatsuba %10.1f ns\n",
+                square ? "squaring" : "multiplication", (unsigned long)c.size, c.schoolbook, c.karatsuba);
+    }
+    fprintf(opts.log, "Karatsuba %s from %lu limbs\n", square ? "squaring" : "multiplication", (unsigned long)limit);
+    (square ? ttmath::KaratsubaSquaringFromSize() : ttmath::KaratsubaMultiplicationFromSize()) = limit;
+}
+
+static const char *arch(){
+#if defined(__x86_64__)
+    return "x86_64";
+#elif defined(__i386__)
+    return "x86";
+#elif defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#else
+    return "unknown";
+#endif
+}
+
+/*
+ * Writes the results as one JSON object. cycles_per_op is null if the
+ * timer does not count cycles.
+ */
+static bool writeJson(const Options &opts, const Timer &timer, const std::vector<Result> &results){
+    FILE *f = strcmp(opts.json, "-") ? fopen(opts.json, "w") : stdout;
+    if (!f) {
+        printf("Could not open %s for writing\n", opts.json);
+        return false;
+    }
+    fprintf(f, "{\n  \"arch\": \"%s\",\n  \"compiler\": \"%s\",\n  \"bits_per_limb\": %d,\n",
+            arch(), __VERSION__, int(TTMATH_BITS_PER_UINT));
+    fprintf(f, "  \"karatsuba_multiplication_from\": %lu,\n  \"karatsuba_squaring_from\": %lu,\n",
+            (unsigned long)ttmath::KaratsubaMultiplicationFromSize(), (unsigned long)ttmath::KaratsubaSquaringFromSize());
+    fprintf(f, "  \"timer\": \"%s\",\n  \"timer_hz\": %llu,\n  \"timer_overhead_ns\": %.1f,\n  \"runs\": %d,\n",
+            Timer::name(timer.source), (unsigned long long)timer.frequency(), timer.overhead(), opts.runs);
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        const double c = cycles(timer, r.median);
+        fprintf(f, "    {\"name\": \"%s\", \"bits\": %ld, \"iterations\": %llu, \"ns_per_op\": %.3f, "
+                   "\"ns_min\": %.3f, \"ns_max\": %.3f, \"ns_mad\": %.3f, ",
+                r.name.c_str(), r.bits, (unsigned long long)r.iterations, r.median, r.min, r.max, r.mad);
+        if (c >= 0) {
+            fprintf(f, "\"cycles_per_op\": %.1f}", c);
+        }
+        else {
+            fprintf(f, "\"cycles_per_op\": null}");
+        }
+        fprintf(f, "%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) {
+        fclose(f);
+    }
+    return true;
+}
+
+void usage(){
+    printf("Usage: ./bench [options]\n");
+    printf("Times the Rsa math and the ttmath multiplications and divisions it uses.\n");
+    printf("Options:\n");
+    printf("  --bits <512|1024|2048|4096>  operand size, can be repeated (default all)\n");
+    printf("  --filter <name>              only benchmarks whose name contains <name>\n");
+    printf("  --runs <r>                   timed runs of every benchmark (default 11)\n");
+    printf("  --min-time <ms>              length of every run (default 20)\n");
+    printf("  --timer <system|steady|tsc|cntvct>\n");
+    printf("                               clock to time with (default tsc or cntvct if there)\n");
+    printf("  --json <file>                write the results as JSON, - for stdout\n");
+    printf("  --tune [file]                measure the Karatsuba limits of this machine and write\n");
+    printf("                               them to file (default %s), which the programs read\n", DefaultTuningFile);
+}
+
+int main(int argc, const char * argv[]) {
+    Options opts;
+    opts.runs = 11;
+    opts.minTime = 20;
+    opts.timer = Timer::available(TIMER_TSC) ? TIMER_TSC
+               : Timer::available(TIMER_CNTVCT) ? TIMER_CNTVCT : TIMER_STEADY;
+    opts.json = NULL;
+    opts.tune = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bits") && i + 1 < argc) {
+            opts.bits.push_back(atol(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            opts.filter = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            opts.runs = atoi(argv[++i]);
+            if (opts.runs < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            opts.minTime = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--timer") && i + 1 < argc) {
+            if (!Timer::parse(argv[++i], opts.timer)) { usage(); return 1; }
+            if (!Timer::available(opts.timer)) {
+                printf("The %s timer is not available on this machine\n", Timer::name(opts.timer));
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            opts.json = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tune")) {
+            opts.tune = (i + 1 < argc && argv[i+1][0] != '-') ? argv[++i] : DefaultTuningFile;
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (opts.bits.empty()) {
+        opts.bits = {512, 1024, 2048, 4096};
+    }
+
+    const Timer timer(opts.timer);
+    opts.log = (opts.json && !strcmp(opts.json, "-")) ? stderr : stdout;
+    fprintf(opts.log, "Timing with %s (%.1f ns overhead), %d runs of >= %g ms\n",
+            Timer::name(timer.source), timer.overhead(), opts.runs, opts.minTime);
+    if (opts.tune) {
+        tuneLimit(false, opts, timer);
+        tuneLimit(true, opts, timer);
+        if (!saveTuning(opts.tune)) {
+            fprintf(opts.log, "Could not write %s\n", opts.tune);
+            return 1;
+        }
+        fprintf(opts.log, "Wrote %s\n", opts.tune);
+        return 0;
+    }
+    loadTuning(DefaultTuningFile, opts.log);
+
+    std::vector<Result> results;
+    for (long bits : opts.bits) {
+        switch (bits) {
+            case 512: benchSize<RSA_LIMBS(512)>(bits, opts, timer, results); break;
+            case 1024: benchSize<RSA_LIMBS(1024)>(bits, opts, timer, results); break;
+            case 2048: benchSize<RSA_LIMBS(2048)>(bits, opts, timer, results); break;
+            case 4096: benchSize<RSA_LIMBS(4096)>(bits, opts, timer, results); break;
+            default:
+                fprintf(opts.log, "Unsupported operand size %ld\n", bits);
+                return 1;
+        }
+    }
+    return (opts.json && !writeJson(opts, timer, results)) ? 1 : 0;
+}
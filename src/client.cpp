@@ -0,0 +1,463 @@
+//
+//  client.cpp
+//  rsa
+//
+//  Pipelined UDP client for the signing server (csv --client).
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "client.h"
+#include "dataset.h"
+#include "protocol.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+
+namespace client {
+
+const char *Pipeline::name(StampSource source){
+    switch (source) {
+        case STAMP_HARDWARE: return "hardware";
+        case STAMP_SOFTWARE: return "kernel";
+        case STAMP_USER: return "user space";
+    }
+    return "unknown";
+}
+
+#ifdef __linux__
+
+/*
+ * Datagrams sent or received with one sendmmsg or recvmmsg.
+ */
+const int Batch = 64;
+
+/*
+ * Room for the control messages of one datagram: the timestamps, and on the
+ * error queue the extended error that carries the OPT_ID key.
+ */
+const size_t ControlBytes = 256;
+
+static int64_t steadyNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t stampNs(const timespec &t){
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+/*
+ * The software and hardware timestamps in the control messages of a
+ * datagram or an error queue entry, 0 where there is none, and the OPT_ID key
+ * of an error queue entry, -1 if there is none.
+ */
+static void readStamps(msghdr &msg, int64_t &software, int64_t &hardware, int64_t &key){
+    software = hardware = 0;
+    key = -1;
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(c), sizeof(stamps));
+            software = stampNs(stamps.ts[0]);
+            hardware = stampNs(stamps.ts[2]);
+        }
+        else if ((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR)
+                 || (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(c), sizeof(error));
+            if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING
+                && error.ee_info == SCM_TSTAMP_SND) {
+                key = error.ee_data;
+            }
+        }
+    }
+}
+
+Pipeline::Pipeline(const Timer &timer, const Settings &settings)
+    :timer(timer),settings(settings),sock(-1),stamping(false),txKeys(0){
+}
+
+Pipeline::~Pipeline(){
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+bool Pipeline::connect(const char *host, int port){
+    addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;      // the server listens on IPv4
+    hints.ai_socktype = SOCK_DGRAM;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    int status = getaddrinfo(host, service, &hints, &found);
+    if (status != 0) {
+        printf("Could not resolve %s: %s\n", host, gai_strerror(status));
+        return false;
+    }
+    sock = socket(found->ai_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock < 0 || ::connect(sock, found->ai_addr, found->ai_addrlen) != 0) {
+        printf("Could not connect to %s:%d: %s\n", host, port, strerror(errno));
+        freeaddrinfo(found);
+        return false;
+    }
+    freeaddrinfo(found);
+
+    // Room for every response in flight, if the kernel allows that much.
+    int buffer = 16 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    if (settings.kernelStamps) {
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+                  | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+                  | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        stamping = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+        txKeys = 0;
+    }
+    return true;
+}
+
+bool Pipeline::query(const unsigned char *body, size_t bodyBytes, std::vector<unsigned char> &response){
+    std::vector<unsigned char> request(protocol::IdBytes + bodyBytes);
+    const uint64_t id = 0;
+    dataset::put64(&request[0], id);
+    std::copy(body, body + bodyBytes, request.begin() + protocol::IdBytes);
+    response.resize(65536);
+    for (int attempt = 0; attempt < 5; attempt++) {
+        if (send(sock, &request[0], request.size(), 0) == ssize_t(request.size())) {
+            txKeys++;
+        }
+        const int64_t deadline = steadyNs() + int64_t(settings.timeoutMs) * 1000000;
+        for (int64_t now = steadyNs(); now < deadline; now = steadyNs()) {
+            pollfd fd = {sock, POLLIN, 0};
+            if (::poll(&fd, 1, int((deadline - now) / 1000000) + 1) <= 0 || !(fd.revents & POLLIN)) {
+                // the send timestamps wake up poll too, and are of no use here
+                unsigned char control[ControlBytes];
+                msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                while (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0) {
+                    msg.msg_controllen = sizeof(control);
+                }
+                continue;
+            }
+            ssize_t length = recv(sock, &response[0], response.size(), MSG_DONTWAIT);
+            if (length >= ssize_t(protocol::IdBytes) && dataset::get64(&response[0]) == id) {
+                response.resize(length);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * A request in flight. id is 0 while the slot is free, and the slot index
+ * plus a sequence number in the upper half otherwise, so a late response to
+ * a lost request does not match the request that took its slot.
+ */
+struct Request {
+    uint64_t id;
+    uint64_t sentTicks, receivedTicks;  // Timer, around sendmmsg and recvmmsg
+    int64_t deadline;                   // steady clock ns
+    int64_t txSoftware, txHardware, rxSoftware, rxHardware;
+    uint32_t inflight;                  // other requests out when it was sent
+    bool answered;
+    bool stalled;                       // counted in Report::stalls already
+};
+
+/*
+ * Send timestamp key of a request, in a ring indexed by the key.
+ */
+struct KeyEntry {
+    uint64_t key, id;
+};
+
+Report Pipeline::run(uint64_t count, size_t requestBytes, size_t responseBytes, const FillRequest &fill,
+                     const Complete &complete){
+    const size_t inflight = size_t(settings.inflight);
+    const size_t datagramBytes = protocol::IdBytes + requestBytes;
+    const size_t responseDatagram = protocol::IdBytes + responseBytes;
+    const int64_t interval = settings.rate > 0 ? int64_t(1e9 / settings.rate) : 0;
+    const int64_t timeout = int64_t(settings.timeoutMs) * 1000000;
+    // How long an answered request waits for its send timestamp.
+    const int64_t stampGrace = std::min<int64_t>(timeout, 10000000);
+
+    std::vector<Request> requests(inflight);
+    std::vector<unsigned char> datagrams(inflight * datagramBytes), responses(inflight * responseBytes);
+    std::vector<uint32_t> idle;
+    for (size_t i = inflight; i-- > 0;) {
+        requests[i].id = 0;
+        idle.push_back(uint32_t(i));
+    }
+    size_t ringSize = 1;
+    while (ringSize < 4 * inflight) {
+        ringSize <<= 1;
+    }
+    std::vector<KeyEntry> ring(ringSize);
+    for (auto &entry : ring) {
+        entry.key = ~uint64_t(0);
+    }
+
+    std::vector<unsigned char> received(Batch * responseDatagram + Batch);
+    std::vector<unsigned char> control(Batch * ControlBytes);
+    mmsghdr sendMsgs[Batch], recvMsgs[Batch];
+    iovec sendVecs[Batch], recvVecs[Batch];
+    uint32_t batchSlots[Batch];
+
+    Report report;
+    memset(&report, 0, sizeof(report));
+    uint64_t completed = 0, sequence = 0;
+    uint32_t out = 0;       // sent and neither answered nor given up on
+    const int64_t begin = steadyNs();
+    int64_t nextSend = begin, lastScan = begin, lastAnswer = begin;
+
+    // Times an answered request with the best pair of stamps it has.
+    auto finish = [&](uint32_t slot){
+        Request &r = requests[slot];
+        StampSource source = STAMP_USER;
+        int64_t roundTrip = timer.elapsed(r.sentTicks, r.receivedTicks).count();
+        if (r.txHardware && r.rxHardware) {
+            source = STAMP_HARDWARE;
+            roundTrip = r.rxHardware - r.txHardware;
+        }
+        else if (r.txSoftware && r.rxSoftware) {
+            source = STAMP_SOFTWARE;
+            roundTrip = r.rxSoftware - r.txSoftware;
+        }
+        report.sources[source]++;
+        completed++;
+        complete(&datagrams[slot * datagramBytes + protocol::IdBytes], &responses[slot * responseBytes],
+                 responseBytes, roundTrip, source, r.inflight);
+        r.id = 0;
+        idle.push_back(slot);
+    };
+
+    // Requests filled in and not sent yet, because the send buffer was full.
+    int batch = 0;
+    while (completed < count) {
+        // Send what is due, keeping at most inflight requests out.
+        int64_t now = steadyNs();
+        while (batch < Batch && !idle.empty() && completed + (inflight - idle.size()) < count
+               && (interval == 0 || now >= nextSend)) {
+            const uint32_t slot = idle.back();
+            idle.pop_back();
+            Request &r = requests[slot];
+            r.id = (++sequence << 32) | slot;
+            r.answered = false;
+            r.stalled = false;
+            r.deadline = INT64_MAX;     // not given up on before it is sent
+            r.txSoftware = r.txHardware = r.rxSoftware = r.rxHardware = 0;
+            unsigned char *datagram = &datagrams[slot * datagramBytes];
+            dataset::put64(datagram, r.id);
+            fill(datagram + protocol::IdBytes);
+            batchSlots[batch++] = slot;
+            if (interval > 0) {
+                if (now - nextSend > interval) {
+                    r.stalled = true;
+                    report.stalls++;
+                }
+                nextSend += interval;
+            }
+        }
+        for (int i = 0; i < batch; i++) {
+            sendVecs[i].iov_base = &datagrams[batchSlots[i] * datagramBytes];
+            sendVecs[i].iov_len = datagramBytes;
+            memset(&sendMsgs[i].msg_hdr, 0, sizeof(msghdr));
+            sendMsgs[i].msg_hdr.msg_iov = &sendVecs[i];
+            sendMsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int done = 0;
+        while (done < batch) {
+            const uint64_t ticks = timer.start();
+            int k = sendmmsg(sock, sendMsgs + done, batch - done, 0);
+            if (k <= 0 && errno == EINTR) {
+                continue;
+            }
+            if (k <= 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // The send buffer is full. Keep the rest for when poll says
+                // there is room, and receive in the meantime. A request
+                // held back over several passes is counted once.
+                for (int i = done; i < batch; i++) {
+                    Request &r = requests[batchSlots[i]];
+                    if (!r.stalled) {
+                        r.stalled = true;
+                        report.stalls++;
+                    }
+                }
+                break;
+            }
+            if (k <= 0) {
+                // The kernel refused it, as if it was lost on the way.
+                requests[batchSlots[done]].id = 0;
+                idle.push_back(batchSlots[done]);
+                report.lost++;
+                done++;
+                continue;
+            }
+            report.sent += k;
+            const int64_t deadline = steadyNs() + timeout;
+            for (int i = done; i < done + k; i++) {
+                Request &r = requests[batchSlots[i]];
+                r.sentTicks = ticks;
+                r.deadline = deadline;
+                r.inflight = out++;
+                KeyEntry &entry = ring[txKeys % ringSize];
+                entry.key = txKeys++;
+                entry.id = r.id;
+            }
+            done += k;
+        }
+        std::copy(batchSlots + done, batchSlots + batch, batchSlots);
+        batch -= done;
+
+        // Wait for responses, for the next send, or for room to send what is left.
+        int64_t wait = (interval > 0) ? nextSend - steadyNs() : 1000000;
+        if (batch == 0 && !idle.empty() && interval == 0 && completed + (inflight - idle.size()) < count) {
+            wait = 0;
+        }
+        wait = std::max<int64_t>(0, std::min<int64_t>(wait, 1000000));
+        pollfd fd = {sock, short(batch > 0 ? POLLIN | POLLOUT : POLLIN), 0};
+        timespec pause = {0, long(wait)};
+        ppoll(&fd, 1, &pause, NULL);
+
+        // Responses, with their receive timestamps.
+        for (;;) {
+            for (int i = 0; i < Batch; i++) {
+                recvVecs[i].iov_base = &received[i * (responseDatagram + 1)];
+                recvVecs[i].iov_len = responseDatagram + 1;
+                memset(&recvMsgs[i].msg_hdr, 0, sizeof(msghdr));
+                recvMsgs[i].msg_hdr.msg_iov = &recvVecs[i];
+                recvMsgs[i].msg_hdr.msg_iovlen = 1;
+                recvMsgs[i].msg_hdr.msg_control = &control[i * ControlBytes];
+                recvMsgs[i].msg_hdr.msg_controllen = ControlBytes;
+            }
+            int n = recvmmsg(sock, recvMsgs, Batch, MSG_DONTWAIT, NULL);
+            if (n <= 0) {
+                break;
+            }
+            const uint64_t ticks = timer.stop();
+            for (int i = 0; i < n; i++) {
+                const unsigned char *datagram = &received[i * (responseDatagram + 1)];
+                if (recvMsgs[i].msg_len != responseDatagram) {
+                    continue;
+                }
+                const uint64_t id = dataset::get64(datagram);
+                const uint32_t slot = uint32_t(id);
+                if (slot >= inflight || requests[slot].id != id || requests[slot].answered) {
+                    continue;   // late, the request was given up on
+                }
+                Request &r = requests[slot];
+                int64_t key;
+                readStamps(recvMsgs[i].msg_hdr, r.rxSoftware, r.rxHardware, key);
+                r.receivedTicks = ticks;
+                r.answered = true;
+                r.deadline = steadyNs() + stampGrace;
+                out--;
+                report.answered++;
+                lastAnswer = steadyNs();
+                memcpy(&responses[slot * responseBytes], datagram + protocol::IdBytes, responseBytes);
+                if (!stamping || (r.rxHardware ? r.txHardware : r.txSoftware)) {
+                    finish(slot);
+                }
+            }
+        }
+
+        // Send timestamps, from the error queue.
+        while (stamping) {
+            unsigned char buffer[ControlBytes];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = buffer;
+            msg.msg_controllen = sizeof(buffer);
+            if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                break;
+            }
+            int64_t software, hardware, key;
+            readStamps(msg, software, hardware, key);
+            const KeyEntry &entry = ring[uint64_t(key) % ringSize];
+            if (key < 0 || entry.key != uint64_t(key)) {
+                continue;
+            }
+            const uint32_t slot = uint32_t(entry.id);
+            Request &r = requests[slot];
+            if (r.id != entry.id) {
+                continue;
+            }
+            if (software) r.txSoftware = software;
+            if (hardware) r.txHardware = hardware;
+            if (r.answered && (r.rxHardware ? r.txHardware : r.txSoftware)) {
+                finish(slot);
+            }
+        }
+
+        // Give up on the requests that took too long, at most once a millisecond.
+        now = steadyNs();
+        if (now - lastScan >= 1000000) {
+            lastScan = now;
+            if (now - lastAnswer > 10 * timeout) {
+                printf("No response for %d ms, giving up\n", 10 * settings.timeoutMs);
+                break;
+            }
+            for (uint32_t slot = 0; slot < inflight; slot++) {
+                Request &r = requests[slot];
+                if (r.id == 0 || now < r.deadline) {
+                    continue;
+                }
+                if (r.answered) {
+                    finish(slot);     // the send timestamp it waited for did not come
+                }
+                else {
+                    r.id = 0;
+                    idle.push_back(slot);
+                    report.lost++;
+                    out--;
+                }
+            }
+        }
+    }
+    report.seconds = (steadyNs() - begin) / 1e9;
+    return report;
+}
+
+#else
+
+Pipeline::Pipeline(const Timer &timer, const Settings &settings)
+    :timer(timer),settings(settings),sock(-1),stamping(false),txKeys(0){
+}
+
+Pipeline::~Pipeline(){
+}
+
+bool Pipeline::connect(const char *, int){
+    printf("--client is only implemented on Linux\n");
+    return false;
+}
+
+bool Pipeline::query(const unsigned char *, size_t, std::vector<unsigned char> &){
+    return false;
+}
+
+Report Pipeline::run(uint64_t, size_t, size_t, const FillRequest &, const Complete &){
+    Report report;
+    memset(&report, 0, sizeof(report));
+    return report;
+}
+
+#endif
+
+} // namespace client
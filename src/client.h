@@ -0,0 +1,123 @@
+//
+//  client.h
+//  rsa
+//
+//  Pipelined UDP client for the signing server (csv --client).
+//
+
+#ifndef __rsa__client__
+#define __rsa__client__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "timer.h"
+
+namespace client {
+
+/*
+ * Clock a round trip was measured with, best first.
+ */
+enum StampSource {
+    STAMP_HARDWARE = 0,     // NIC timestamps of the send and the receive, SO_TIMESTAMPING
+    STAMP_SOFTWARE = 1,     // kernel timestamps, SO_TIMESTAMPING
+    STAMP_USER = 2          // the Timer, read around sendmmsg and recvmmsg
+};
+
+const int StampSources = 3;
+
+struct Settings {
+    int inflight;           // requests sent and not answered yet, at most
+    double rate;            // requests per second to send at, 0 sends as fast as inflight allows
+    int timeoutMs;          // a request not answered by then is lost, and sent again as a new one
+    bool kernelStamps;      // ask for SO_TIMESTAMPING, if the kernel has it
+};
+
+/*
+ * What a run did. A stall is a request sent later than the rate schedule
+ * asked for, because inflight requests were already out, or held back
+ * because the send buffer was full.
+ */
+struct Report {
+    uint64_t sent, answered, lost, stalls;
+    uint64_t sources[StampSources];
+    double seconds;
+};
+
+/*
+ * Body of a new request, the bytes after the request id, of Pipeline::requestBytes.
+ */
+typedef std::function<void(unsigned char *body)> FillRequest;
+
+/*
+ * An answered request: its body, the response after the response id,
+ * the round trip in ns, the clock it was measured with, and how many other
+ * requests were out when it was sent, whose answers it may have queued behind.
+ */
+typedef std::function<void(const unsigned char *body, const unsigned char *response, size_t responseBytes,
+                           int64_t roundTrip, StampSource source, uint32_t inflight)> Complete;
+
+/*
+ * Keeps up to inflight requests out on one connected UDP socket, sent on an
+ * open loop schedule of rate requests per second, and matches the responses
+ * to the requests by the id that starts every datagram (see protocol.h).
+ * Requests go out and responses come in up to 64 per sendmmsg and recvmmsg.
+ *
+ * Every request is timed on its own. With SO_TIMESTAMPING the kernel (or the
+ * NIC, if it timestamps and is set up to) stamps each datagram when it is sent
+ * and received, the send stamps are read from the error queue by their
+ * SOF_TIMESTAMPING_OPT_ID key, and the round trip is the difference of the two
+ * stamps from the same clock. Otherwise the round trip is taken with the Timer,
+ * from before the sendmmsg that sent the request to after the recvmmsg that
+ * received the response.
+ *
+ * Only implemented on Linux.
+ */
+class Pipeline {
+public:
+    Pipeline(const Timer &timer, const Settings &settings);
+    ~Pipeline();
+
+    /*
+     * Connects to the server, and sets up the timestamps.
+     */
+    bool connect(const char *host, int port);
+
+    /*
+     * Sends one request with id 0 and bodyBytes bytes of body, and waits for
+     * its response, asking again now and then, for up to timeoutMs * 5.
+     * For the key query (no body) and the stop request.
+     */
+    bool query(const unsigned char *body, size_t bodyBytes, std::vector<unsigned char> &response);
+
+    /*
+     * Sends requests with requestBytes byte bodies until count of them have been
+     * answered with responseBytes byte responses, or nothing has been answered
+     * for ten timeouts, and returns what happened.
+     */
+    Report run(uint64_t count, size_t requestBytes, size_t responseBytes, const FillRequest &fill,
+               const Complete &complete);
+
+    /*
+     * True if the kernel agreed to timestamp the datagrams.
+     */
+    bool kernelStamps() const { return stamping; }
+
+    static const char *name(StampSource source);
+
+private:
+    Pipeline(const Pipeline&);
+    Pipeline &operator=(const Pipeline&);
+
+    const Timer &timer;
+    Settings settings;
+    int sock;
+    bool stamping;
+    uint64_t txKeys;        // datagrams sent, the OPT_ID key of the next one
+};
+
+} // namespace client
+
+#endif /* defined(__rsa__client__) */
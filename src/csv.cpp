@@ -1,4 +1,3 @@
-
 //
 //  rsa-signer.cpp
 //  rsa
@@ -10,104 +9,1389 @@
 #include <stdio.h>
 #include <stdio.h>
 #include <fstream>
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
+#include <random>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <new>
+#include <atomic>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
 #include "rsa.h"
-
-typedef std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds > timepoint;
+#include "dataset.h"
+#include "timer.h"
+#include "random.h"
+#include "tuning.h"
+#include "keygen.h"
+#include "protocol.h"
+#include "client.h"
 
 
 /*
  * Data structure to hold message/signature/time it took to sign
+ * With --repeat, duration is the median of the repeated signatures,
+ * and min and mad (median absolute deviation) are filled in as well.
+ * Built with RSA_STATS, stats holds the operation counts of the last signature.
+ * Collected by --client, duration is the round trip, server the duration
+ * the server measured, and inflight the other requests out when it was sent.
  */
+template<ttmath::uint Limbs>
 struct TimedSignature {
-    num message;
-    num signed_message;
+    ttmath::UInt<Limbs> message;
+    ttmath::UInt<Limbs> signed_message;
     std::chrono::nanoseconds duration;
+    std::chrono::nanoseconds min, mad;
+    RsaStats stats;
+    std::chrono::nanoseconds server;
+    uint32_t inflight;
 };
 
 /*
  * Output format for TimedResponse when using cout
  */
-std::ostream& operator<<(std::ostream& os, const TimedSignature& ts){
+template<ttmath::uint Limbs>
+std::ostream& operator<<(std::ostream& os, const TimedSignature<Limbs>& ts){
     os << ts.message << "," << ts.signed_message << "," << ts.duration.count();
     return os;
 }
 
+/*
+ * Command line options.
+ */
+struct Options {
+    const char *p, *q, *e;
+    int messageCount;
+    long bits;          // key size, selects the Rsa instantiation
+    ExpType expType;
+    bool crtThreads;    // run the two CRT halves on two threads
+    int threads;        // signing threads
+    bool pin;           // pin each signing thread to its own core
+    unsigned long seed; // seed for the message RNG, thread i uses stream i of it
+    long long simulatePenalty; // ns added per step 4 subtraction instead of sleeping, 0 sleeps for real
+    long long simulateJitter;  // standard deviation in ns of each simulated sleep
+    bool simulateOnly;         // record only the simulated time, not the measured time
+    bool binary;               // write data.bin instead of data.csv
+    bool asyncWriter;          // write the samples on a writer thread while signing
+    TimerSource timer;         // clock the signatures are timed with
+    int repeat;                // timed signatures per message
+    int warmup;                // untimed signatures per message before the timed ones
+    bool pregenerate;          // draw all messages before signing the first
+    int servePort;             // sign the messages of UDP clients on this port, 0 signs random messages
+    bool client;               // samples collected from a server, add the client columns
+};
+
+
+/*
+ * Pins the calling thread to the given core (modulo the number of cores).
+ * Only implemented on Linux, elsewhere the thread is left to the scheduler.
+ */
+void pin_to_core(int core){
+#ifdef __linux__
+    int cores = std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cores > 0 ? core % cores : 0, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        printf("Warning! Could not pin signing thread to core %d\n", core);
+    }
+#else
+    (void)core;
+#endif
+}
+
+
+/*
+ * Fixed size array that starts on a cache line, allocated once.
+ * T is left default constructed, as for a plain array.
+ */
+template<class T>
+class AlignedArray {
+public:
+    static const size_t Alignment = 64;
+
+    explicit AlignedArray(size_t count):count(count),memory(NULL),data(NULL){
+        if (count == 0) {
+            return;
+        }
+        memory = malloc(count * sizeof(T) + Alignment);
+        if (memory == NULL) {
+            throw std::bad_alloc();
+        }
+        uintptr_t aligned = (uintptr_t(memory) + Alignment - 1) & ~uintptr_t(Alignment - 1);
+        data = new ((void*)aligned) T[count];
+    }
+    ~AlignedArray(){
+        for (size_t i = 0; i < count; i++) {
+            data[i].~T();
+        }
+        free(memory);
+    }
+
+    size_t size() const { return count; }
+    T &operator[](size_t i){ return data[i]; }
+    const T &operator[](size_t i) const { return data[i]; }
+
+private:
+    AlignedArray(const AlignedArray&);
+    AlignedArray &operator=(const AlignedArray&);
+
+    size_t count;
+    void *memory;
+    T *data;
+};
+
+
+/*
+ * Simulated latency of the sleeps MODEXP_SLEEP makes, for a signature
+ * that needed the given number of step 4 subtractions.
+ * Each sleep takes the penalty plus normally distributed jitter,
+ * the total is never negative.
+ */
+template<class Rng>
+std::chrono::nanoseconds simulated_sleep(const Options &opts, const long subtractions, Rng &rng){
+    double total = double(opts.simulatePenalty) * subtractions;
+    if (opts.simulateJitter > 0 && subtractions > 0) {
+        std::normal_distribution<double> jitter(0.0, double(opts.simulateJitter) * sqrt(double(subtractions)));
+        total += jitter(rng);
+    }
+    return std::chrono::nanoseconds(total > 0 ? (long long)(total + 0.5) : 0);
+}
+
+
+/*
+ * Output file for the samples, data.csv or (with --format binary) data.bin.
+ */
+template<ttmath::uint Limbs>
+class SampleSink {
+public:
+    SampleSink():eWord(0),invalid(0){}
+
+    bool open(const Options &opts, const ttmath::UInt<Limbs> &n, const ttmath::UInt<Limbs> &e, const Timer &timer){
+        binary = opts.binary;
+        if (binary) {
+            writer.setTimer(timer.source, timer.frequency(), uint64_t(timer.overhead() * 1000 + 0.5));
+            writer.setRepeat(opts.repeat, opts.warmup);
+            writer.setStats(RsaStats::Enabled);
+            writer.setClient(opts.client);
+            return writer.open("data.bin", n, e, Rsa<Limbs>::numBits(n), opts.messageCount);
+        }
+        csvfile.open("data.csv");
+        csvfile << "N,E" << std::endl;
+        csvfile << n << "," << e << std::endl;
+        aggregates = opts.repeat > 1;
+        client = opts.client;
+        csvfile << (aggregates ? "message,signature,duration,min,mad" : "message,signature,duration");
+        for (int c = 0; RsaStats::Enabled && c < dataset::StatsColumns; c++) {
+            csvfile << "," << dataset::StatsColumnNames[c];
+        }
+        for (int c = 0; client && c < dataset::ClientColumns; c++) {
+            csvfile << "," << dataset::ClientColumnNames[c];
+        }
+        csvfile << std::endl;
+        return bool(csvfile);
+    }
+
+    /*
+     * Checks every signature written from now on with the public exponent e,
+     * see invalidSignatures. Only done when e fits in a word.
+     */
+    void verifyWith(const ttmath::UInt<Limbs> &n, const ttmath::UInt<Limbs> &e){
+        publicKey = typename Rsa<Limbs>::Context(n);
+        eWord = (Rsa<Limbs>::numBits(e) <= long(TTMATH_BITS_PER_UINT)) ? e.table[0] : 0;
+    }
+
+    uint64_t invalidSignatures() const { return invalid; }
+
+    void write(const TimedSignature<Limbs> &current){
+        const RsaStats &s = current.stats;
+        const uint64_t operations[dataset::StatsColumns] = {
+            s.products, s.squarings, s.subtractions, s.squareCycles, s.multiplyCycles
+        };
+        const int64_t clients[dataset::ClientColumns] = {current.server.count(), int64_t(current.inflight)};
+        if (eWord != 0 && Rsa<Limbs>::ModExpPublic(current.signed_message, eWord, publicKey) != current.message) {
+            invalid++;
+        }
+        if (binary) {
+            writer.append(current.message, current.signed_message, current.duration.count(),
+                          current.min.count(), current.mad.count(), operations, clients);
+            return;
+        }
+        csvfile << current;
+        if (aggregates) {
+            csvfile << "," << current.min.count() << "," << current.mad.count();
+        }
+        for (int c = 0; RsaStats::Enabled && c < dataset::StatsColumns; c++) {
+            csvfile << "," << (unsigned long long)operations[c];
+        }
+        for (int c = 0; client && c < dataset::ClientColumns; c++) {
+            csvfile << "," << (long long)clients[c];
+        }
+        csvfile << "\n";
+    }
+
+    bool close(){
+        if (binary) {
+            return writer.close();
+        }
+        csvfile.close();
+        return bool(csvfile);
+    }
+
+private:
+    bool binary, aggregates, client;
+    std::ofstream csvfile;
+    dataset::Writer<Limbs> writer;
+    typename Rsa<Limbs>::Context publicKey;
+    ttmath::uint eWord;
+    uint64_t invalid;
+};
+
+
+/*
+ * Moves the samples from the signing threads to the sink a block at a time,
+ * so the memory used does not grow with the number of samples.
+ *
+ * With a writer thread, formatting and file I/O does not run on the signing
+ * cores: every signing thread fills a block of samples, and only takes the
+ * lock to queue it for the writer thread when it is full, between two timed
+ * signatures, and to take a drained one. It never waits for the writer thread.
+ * AsyncBlocks blocks per thread are preallocated, and when the writer thread
+ * has fallen so far behind that none of them is drained, the signing thread
+ * takes a new one instead, which is counted as an overrun.
+ * Without a writer thread, a signing thread writes its full block to the sink
+ * itself, under the lock.
+ * The samples of each signing thread are written in order, the blocks of
+ * different threads are interleaved.
+ */
+template<ttmath::uint Limbs>
+class AsyncWriter {
+public:
+    AsyncWriter(SampleSink<Limbs> &sink, int producers, size_t blockSize, bool threaded)
+        :sink(sink),blockSize(blockSize),threaded(threaded),producers(producers),finished(0),overrunCount(0){
+        for (auto &producer : this->producers) {
+            producer.current = newBlock();
+            for (int b = 1; threaded && b < AsyncBlocks; b++) {
+                producer.drained.push_back(newBlock());
+            }
+            producer.fill = 0;
+        }
+    }
+
+    /*
+     * Slot for the next sample of the given signing thread.
+     */
+    TimedSignature<Limbs> &slot(int producer){
+        Producer &p = producers[producer];
+        return p.current->samples[p.fill];
+    }
+
+    /*
+     * Marks the slot as written, and hands the block over when it is full.
+     */
+    void commit(int producer){
+        Producer &p = producers[producer];
+        if (++p.fill == blockSize) {
+            handOver(p);
+        }
+    }
+
+    /*
+     * Hands over the last, partially filled block of a signing thread.
+     */
+    void finish(int producer){
+        Producer &p = producers[producer];
+        if (p.fill > 0) {
+            handOver(p);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        finished++;
+        cond.notify_all();
+    }
+
+    /*
+     * Body of the writer thread, returns when every signing thread has finished
+     * and every block is written.
+     */
+    void run(){
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            Block *block = NULL;
+            Producer *owner = NULL;
+            for (auto &producer : producers) {
+                if (!producer.full.empty()) {
+                    owner = &producer;
+                    block = producer.full.front();
+                    producer.full.pop_front();
+                    break;
+                }
+            }
+            if (block == NULL) {
+                if (finished == int(producers.size())) {
+                    return;
+                }
+                cond.wait(lock);
+                continue;
+            }
+            lock.unlock();
+            for (size_t i = 0; i < block->count; i++) {
+                sink.write(block->samples[i]);
+            }
+            lock.lock();
+            owner->drained.push_back(block);
+        }
+    }
+
+    /*
+     * Blocks the signing threads took because none was drained.
+     */
+    uint64_t overruns(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return overrunCount;
+    }
+
+    /*
+     * Blocks preallocated per signing thread with a writer thread.
+     */
+    static const int AsyncBlocks = 4;
+
+private:
+    struct Block {
+        std::vector<TimedSignature<Limbs> > samples;
+        size_t count;
+    };
+    struct Producer {
+        Block *current;
+        std::deque<Block*> full;    // waiting for the writer thread, oldest first
+        std::vector<Block*> drained;
+        size_t fill;
+    };
+
+    Block *newBlock(){
+        blocks.emplace_back(new Block());
+        blocks.back()->samples.resize(blockSize);
+        blocks.back()->count = 0;
+        return blocks.back().get();
+    }
+
+    void handOver(Producer &p){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!threaded) {
+            for (size_t i = 0; i < p.fill; i++) {
+                sink.write(p.current->samples[i]);
+            }
+            p.fill = 0;
+            return;
+        }
+        p.current->count = p.fill;
+        p.full.push_back(p.current);
+        cond.notify_all();
+        p.fill = 0;
+        if (p.drained.empty()) {
+            overrunCount++;
+            p.current = newBlock();
+        }
+        else {
+            p.current = p.drained.back();
+            p.drained.pop_back();
+        }
+    }
+
+    SampleSink<Limbs> &sink;
+    const size_t blockSize;
+    const bool threaded;
+    std::vector<Producer> producers;
+    std::vector<std::unique_ptr<Block> > blocks;
+    int finished;
+    uint64_t overrunCount;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+
+/*
+ * Median of the durations, which are reordered.
+ */
+std::chrono::nanoseconds median(std::vector<std::chrono::nanoseconds> &durations){
+    const size_t mid = durations.size() / 2;
+    std::nth_element(durations.begin(), durations.begin() + mid, durations.end());
+    std::chrono::nanoseconds upper = durations[mid];
+    if (durations.size() % 2) {
+        return upper;
+    }
+    std::chrono::nanoseconds lower = *std::max_element(durations.begin(), durations.begin() + mid);
+    return lower + (upper - lower) / 2;
+}
+
+/*
+ * Fills in the duration of a signature from its repeated measurements:
+ * the median as the duration, the minimum, and the median absolute deviation.
+ */
+template<ttmath::uint Limbs>
+void summarize(std::vector<std::chrono::nanoseconds> &durations, TimedSignature<Limbs> &current){
+    if (durations.size() == 1) {
+        current.duration = current.min = durations[0];
+        current.mad = std::chrono::nanoseconds(0);
+        return;
+    }
+    current.min = *std::min_element(durations.begin(), durations.end());
+    current.duration = median(durations);
+    for (auto &duration : durations) {
+        duration = (duration > current.duration) ? duration - current.duration : current.duration - duration;
+    }
+    current.mad = median(durations);
+}
+
+
+/*
+ * Signs one message for the dataset: warmup times untimed, and then once for
+ * every entry of durations, timed, and fills in current with the message, the
+ * signature, the summarized durations and (built with RSA_STATS) the operation
+ * counts of the last timed signature.
+ *
+ * With --simulate, MODEXP_SLEEP does not sleep but counts the subtractions it would
+ * sleep for, and adds a simulated sleep for them, drawn from jitterRng, to the duration.
+ */
+template<ttmath::uint Limbs, ExpType type, class Rng>
+void sign_timed(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &message, const Options &opts, const Timer &timer,
+                std::vector<std::chrono::nanoseconds> &durations, Rng &jitterRng, TimedSignature<Limbs> &current){
+    const bool simulate = (type == MODEXP_SLEEP && opts.simulatePenalty > 0);
+    uint64_t start, end;
+    long subtractions;
+    current.message = message;
+    for (int w = 0; w < opts.warmup; w++) {
+        current.signed_message = simulate ? rsa.signCounted(message, subtractions)
+                                          : rsa.template sign<type>(message);
+    }
+    for (auto &duration : durations) {
+        if (RsaStats::Enabled) {
+            RsaStats::current().reset();
+        }
+        if (simulate) {
+            start = timer.start();
+            current.signed_message = rsa.signCounted(message, subtractions);
+            end = timer.stop();
+            duration = simulated_sleep(opts, subtractions, jitterRng);
+            if (!opts.simulateOnly) {
+                duration += timer.elapsed(start, end);
+            }
+        }
+        else {
+            start = timer.start();
+            current.signed_message = rsa.template sign<type>(message);
+            end = timer.stop();
+            duration = timer.elapsed(start, end);
+        }
+    }
+    summarize(durations, current);
+    if (RsaStats::Enabled) {
+        current.stats = RsaStats::current();
+    }
+}
+
+
+/*
+ * Signs messages on one thread, and pushes the results to the writer,
+ * which with --async-writer hands them to the writer thread.
+ * The Rsa object is a copy owned by the thread, and the clock is read on the thread.
+ * timer is shared read only, it was calibrated before the threads started.
+ *
+ * With --simulate, MODEXP_SLEEP does not sleep but counts the subtractions it would
+ * sleep for, and adds a simulated sleep for them to the duration.
+ * With --repeat every message is signed warmup times untimed, and then
+ * repeat times timed, and the durations are summarized.
+ * With --pregenerate all messages of the thread are drawn before the first
+ * signature, and the signing loop walks the pool.
+ * Built with RSA_STATS, the operation counts of each timed signature are kept,
+ * of the last one with --repeat.
+ */
+template<ttmath::uint Limbs, ExpType type>
+void sign_worker(Rsa<Limbs> rsa, const int messageCount, const unsigned long seed, const int core,
+                 const Options &opts, const Timer &timer, AsyncWriter<Limbs> *writer){
+    if (opts.pin) {
+        pin_to_core(core);
+    }
+    // Thread t draws from stream t of the seed, and the jitter from stream t
+    // of a second family, so the messages don't depend on the jitter.
+    Xoshiro256 rng(seed), jitterRng(seed);
+    jitterRng.longJump();
+    for (int t = 0; t < core; t++) {
+        rng.jump();
+        jitterRng.jump();
+    }
+    ttmath::UInt<Limbs> fresh;
+    AlignedArray<ttmath::UInt<Limbs> > pool(opts.pregenerate ? messageCount : 0);
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool[i] = bigrand(rsa.n, rng);
+    }
+    std::vector<std::chrono::nanoseconds> durations(opts.repeat);
+    for (int i = 0; i < messageCount; i++) {
+        TimedSignature<Limbs> &current = writer->slot(core);
+        // Generate a random message between 0 and the modulus, or take the next one from the pool.
+        const ttmath::UInt<Limbs> &message = opts.pregenerate ? pool[i] : (fresh = bigrand(rsa.n, rng));
+        sign_timed<Limbs, type>(rsa, message, opts, timer, durations, jitterRng, current);
+        writer->commit(core);
+    }
+    writer->finish(core);
+}
 
-void timed_sign(const int messageCount);
-num bigrand(num max);
-Rsa rsa;
 
+/*
+ * Samples per block handed from a signing thread to the writer.
+ */
+const size_t AsyncBlockSize = 4096;
 
 /*
- * RNG with arbitrary large size (up to sizeof(num)).
+ * Runs the writer thread of an AsyncWriter, and reports how often it fell behind.
  */
-num bigrand(num max = 0){
-    num result = 0;
-    for (auto &el:result.table) {
-        el = random();
+template<ttmath::uint Limbs>
+void write_worker(AsyncWriter<Limbs> *async, const int core, const bool pin){
+    if (pin) {
+        pin_to_core(core);
+    }
+    async->run();
+    if (uint64_t overruns = async->overruns()) {
+        printf("Warning! The writer thread fell behind, and %llu more blocks of %zu samples were allocated\n",
+               (unsigned long long)overruns, AsyncBlockSize);
     }
-    return (max == 0) ? result : result % max;
 }
 
 
-void teste(){
-    std::cout << rsa.sign(1283) << std::endl;
+/*
+ * Generate @messageCount random messages, sign them, and return the time it took.
+ *
+ * The exponentiation routine is a template argument, so the call in the
+ * timing loop is direct instead of going through Rsa's function pointer.
+ * With more than one thread every thread signs its own share of the messages,
+ * and the shares are written to data.csv in blocks of AsyncBlockSize samples,
+ * while they are signed, so runs of any length need the same memory.
+ * With --format binary they are written to data.bin instead, see dataset.h.
+ * With --async-writer a writer thread writes the blocks, instead of the
+ * signing threads between two signatures.
+ */
+template<ttmath::uint Limbs, ExpType type>
+void timed_sign(Rsa<Limbs> &rsa, const Options &opts){
+    const int messageCount = opts.messageCount;
+    const int threads = opts.threads;
+    printf("Signing %d random messages on %d thread(s) (this could take a while)....\n", messageCount, threads);
+
+    const Timer timer(opts.timer);
+    printf("Timing with the %s timer (%llu Hz), overhead %.1f ns\n", Timer::name(timer.source),
+           (unsigned long long)timer.frequency(), timer.overhead());
+
+    SampleSink<Limbs> sink;
+    if (!sink.open(opts, rsa.n, rsa.e, timer)) {
+        printf("Could not open the output file\n");
+        return;
+    }
+
+    AsyncWriter<Limbs> writer(sink, threads, AsyncBlockSize, opts.asyncWriter);
+    std::thread writerThread;
+    if (opts.asyncWriter) {
+        writerThread = std::thread(write_worker<Limbs>, &writer, threads, opts.pin);
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        int first = (long long)messageCount * t / threads;
+        int last = (long long)messageCount * (t + 1) / threads;
+        workers.push_back(std::thread(sign_worker<Limbs, type>, rsa, last - first, opts.seed, t,
+                                      std::cref(opts), std::cref(timer), &writer));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    if (opts.asyncWriter) {
+        writerThread.join();
+    }
+    if (!sink.close()) {
+        printf("Could not write the output file\n");
+        return;
+    }
+    printf("done.\n");
 }
 
-int main(int argc, const char * argv[]) {
+#ifdef __linux__
+/*
+ * Set by SIGINT, or by a stop request, see protocol.h.
+ */
+static std::atomic<bool> serverStop(false);
+
+void stop_server(int){
+    serverStop = true;
+}
+
+/*
+ * Signatures served so far. With a message count, taken as tickets, and
+ * only the first messageCount signatures are logged.
+ */
+struct ServerCount {
+    std::atomic<long long> tickets, logged, served, dropped;
+};
+
+/*
+ * Datagrams received or sent with one recvmmsg or sendmmsg.
+ */
+const int ServerBatch = 64;
+
+/*
+ * How long in ms a worker waits for room in a full send buffer before it
+ * drops the responses that did not fit.
+ */
+const int ServerSendWait = 100;
+
+/*
+ * Serves the requests arriving on one socket bound to the port with
+ * SO_REUSEPORT, so the kernel spreads the clients over the sockets of the
+ * worker threads. Each wakeup of epoll drains the socket with recvmmsg, up to
+ * ServerBatch datagrams at a time, signs them one after the other with the
+ * same sign_timed as the local signing, and sends all responses with one
+ * sendmmsg. The duration of every signature is sent back, and with a message
+ * count the first that many are logged, as with sign_worker.
+ */
+template<ttmath::uint Limbs, ExpType type>
+void serve_worker(Rsa<Limbs> rsa, const int core, const Options &opts, const Timer &timer, ServerCount &count,
+                  AsyncWriter<Limbs> *writer){
+    if (opts.pin) {
+        pin_to_core(core);
+    }
+    Xoshiro256 jitterRng(opts.seed);
+    jitterRng.longJump();
+    for (int t = 0; t < core; t++) {
+        jitterRng.jump();
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(uint16_t(opts.servePort));
+    int epollFd = epoll_create1(0);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0
+        || bind(sock, (sockaddr*)&address, sizeof(address)) != 0
+        || epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &event) != 0) {
+        printf("Thread %d could not listen on UDP port %d: %s\n", core, opts.servePort, strerror(errno));
+        serverStop = true;
+    }
+
+    const uint32_t words = dataset::wordsFor<Limbs>();
+    const size_t requestBytes = protocol::signRequestBytes(words);
+    const size_t responseBytes = protocol::keyResponseBytes(words);
+    const uint32_t keyBits = uint32_t(Rsa<Limbs>::numBits(rsa.n));
+    std::vector<unsigned char> requests(ServerBatch * requestBytes), responses(ServerBatch * responseBytes);
+    sockaddr_in peers[ServerBatch];
+    iovec requestVecs[ServerBatch], responseVecs[ServerBatch];
+    mmsghdr received[ServerBatch], sent[ServerBatch];
+    std::vector<std::chrono::nanoseconds> durations(opts.repeat);
+    TimedSignature<Limbs> scratch;
+    ttmath::UInt<Limbs> message;
+
+    while (!serverStop) {
+        // Wake up now and then to see if the server is stopped.
+        if (epoll_wait(epollFd, &event, 1, 100) <= 0) {
+            continue;
+        }
+        // Drained batch by batch, and left as soon as the server is stopped,
+        // so a busy socket does not keep it running.
+        while (!serverStop) {
+            for (int i = 0; i < ServerBatch; i++) {
+                requestVecs[i].iov_base = &requests[i * requestBytes];
+                requestVecs[i].iov_len = requestBytes;
+                memset(&received[i].msg_hdr, 0, sizeof(msghdr));
+                received[i].msg_hdr.msg_name = &peers[i];
+                received[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+                received[i].msg_hdr.msg_iov = &requestVecs[i];
+                received[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(sock, received, ServerBatch, MSG_DONTWAIT, NULL);
+            if (n <= 0) {
+                break;  // drained, or an error, in both cases back to epoll
+            }
+            int replies = 0;
+            for (int i = 0; i < n; i++) {
+                const unsigned char *request = &requests[i * requestBytes];
+                unsigned char *response = &responses[replies * responseBytes];
+                const size_t length = received[i].msg_len;
+                if ((received[i].msg_hdr.msg_flags & MSG_TRUNC) || length < protocol::IdBytes) {
+                    continue;
+                }
+                const uint64_t id = dataset::get64(request);
+                size_t responseLength;
+                if (length == protocol::IdBytes) {
+                    responseLength = protocol::encodeKeyResponse(response, id, rsa.n, rsa.e, keyBits);
+                }
+                else if (length == protocol::StopRequestBytes
+                         && dataset::get64(request + protocol::IdBytes) == protocol::StopMagic) {
+                    // Answered, so the client knows, and the rest of the batch is dropped.
+                    memcpy(response, request, protocol::StopRequestBytes);
+                    responseLength = protocol::StopRequestBytes;
+                    serverStop = true;
+                }
+                else if (length == requestBytes) {
+                    dataset::getNum(request + protocol::IdBytes, words, message);
+                    if (message >= rsa.n) {
+                        continue;
+                    }
+                    // Past the message count the requests are still answered, just not logged.
+                    const bool logged = opts.messageCount > 0 && count.tickets++ < opts.messageCount;
+                    TimedSignature<Limbs> *current = logged ? &writer->slot(core) : &scratch;
+                    sign_timed<Limbs, type>(rsa, message, opts, timer, durations, jitterRng, *current);
+                    responseLength = protocol::encodeSignResponse(response, id, current->signed_message,
+                                                                  (int64_t)current->duration.count());
+                    if (logged) {
+                        writer->commit(core);
+                    }
+                    if (logged && ++count.logged == opts.messageCount) {
+                        printf("Logged %d signatures, answering on until interrupted or stopped\n", opts.messageCount);
+                    }
+                    count.served++;
+                }
+                else {
+                    continue;
+                }
+                responseVecs[replies].iov_base = response;
+                responseVecs[replies].iov_len = responseLength;
+                memset(&sent[replies].msg_hdr, 0, sizeof(msghdr));
+                sent[replies].msg_hdr.msg_name = &peers[i];
+                sent[replies].msg_hdr.msg_namelen = received[i].msg_hdr.msg_namelen;
+                sent[replies].msg_hdr.msg_iov = &responseVecs[replies];
+                sent[replies].msg_hdr.msg_iovlen = 1;
+                replies++;
+                if (serverStop) {
+                    break;
+                }
+            }
+            // sendmmsg may send only the first few, send the rest after them.
+            // A full send buffer is waited for with poll instead of retried
+            // right away, and what still does not fit after ServerSendWait ms is dropped.
+            for (int done = 0; done < replies;) {
+                int k = sendmmsg(sock, sent + done, replies - done, 0);
+                if (k > 0) {
+                    done += k;
+                }
+                else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    pollfd writable = {sock, POLLOUT, 0};
+                    if (::poll(&writable, 1, ServerSendWait) <= 0) {
+                        count.dropped += replies - done;
+                        done = replies;
+                    }
+                }
+                else if (errno != EINTR) {
+                    count.dropped++;    // drop the response that failed, as UDP would
+                    done++;
+                }
+            }
+        }
+    }
+    if (writer) {
+        writer->finish(core);
+    }
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+#endif
+
+
+/*
+ * Signs the messages clients send to UDP port opts.servePort, see protocol.h,
+ * on opts.threads threads each with its own socket on the port, until
+ * interrupted or sent a stop request.
+ * With a message count, the first that many signatures are written to data.csv
+ * or data.bin as timed_sign does, a block at a time, with the durations
+ * measured on the server. The requests after them are answered but not logged,
+ * so a client that lost a few responses still gets its count. With a message
+ * count of 0 nothing is logged.
+ */
+template<ttmath::uint Limbs, ExpType type>
+void serve(Rsa<Limbs> &rsa, const Options &opts){
+#ifdef __linux__
+    const int threads = opts.threads;
+    const bool logged = opts.messageCount > 0;
+    const Timer timer(opts.timer);
+    printf("Timing with the %s timer (%llu Hz), overhead %.1f ns\n", Timer::name(timer.source),
+           (unsigned long long)timer.frequency(), timer.overhead());
+
+    SampleSink<Limbs> sink;
+    if (logged && !sink.open(opts, rsa.n, rsa.e, timer)) {
+        printf("Could not open the output file\n");
+        return;
+    }
+    std::unique_ptr<AsyncWriter<Limbs> > writer;
+    std::thread writerThread;
+    if (logged) {
+        writer.reset(new AsyncWriter<Limbs>(sink, threads, AsyncBlockSize, opts.asyncWriter));
+    }
+    if (logged && opts.asyncWriter) {
+        writerThread = std::thread(write_worker<Limbs>, writer.get(), threads, opts.pin);
+    }
 
-    srandom(time(NULL)); // Seed the RNG
-    if (argc != 5) {
-        printf("Usage: ./rsa-server <p> <q> <e> <message count>\n");
-        printf("Signs <message count> random messages, and saves the result to a CSV file\n");
+    signal(SIGINT, stop_server);
+    ServerCount count;
+    count.tickets = count.logged = count.served = count.dropped = 0;
+    printf("Serving signatures on UDP port %d with %d thread(s), until interrupted or stopped", opts.servePort, threads);
+    if (logged) {
+        printf(", logging the first %d", opts.messageCount);
+    }
+    printf("....\n");
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread(serve_worker<Limbs, type>, rsa, t, std::cref(opts), std::cref(timer),
+                                      std::ref(count), writer.get()));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    printf("Served %lld signatures, logged %lld\n", (long long)count.served, (long long)count.logged);
+    if (count.dropped > 0) {
+        printf("Warning! %lld responses could not be sent, and were dropped\n", (long long)count.dropped);
+    }
+    if (!logged) {
+        return;
+    }
+
+    if (opts.asyncWriter) {
+        writerThread.join();
+    }
+    if (!sink.close()) {
+        printf("Could not write the output file\n");
+        return;
+    }
+    printf("done.\n");
+#else
+    (void)rsa;
+    (void)opts;
+    printf("--serve is only implemented on Linux\n");
+#endif
+}
+
+
+/*
+ * Signs random messages, or with --serve the messages of clients.
+ */
+template<ttmath::uint Limbs, ExpType type>
+void sign_messages(Rsa<Limbs> &rsa, const Options &opts){
+    if (opts.servePort != 0) {
+        serve<Limbs, type>(rsa, opts);
+    }
+    else {
+        timed_sign<Limbs, type>(rsa, opts);
+    }
+}
+
+
+/*
+ * Sets up the key in a num of the selected size and signs the messages.
+ */
+template<ttmath::uint Limbs>
+int run(const Options &opts){
+    typedef Rsa<Limbs> RsaN;
+    typename RsaN::num p = opts.p, q = opts.q;
+    if (RsaN::numBits(p) + RsaN::numBits(q) > long(Limbs * TTMATH_BITS_PER_UINT)) {
+        printf("p*q does not fit in a %ld bit key, use a larger --bits\n", opts.bits);
         return 1;
     }
 
     // Initiate RSA object with primes from command line.
-    rsa = Rsa(argv[1], argv[2], argv[3]);
-    printf("Using Montgomery with (2ms) sleep for exponentiation\n");
-    rsa.setExpFunc(MODEXP_SLEEP);
+    RsaN rsa(p, q, opts.e);
+    rsa.setExpFunc(opts.expType);
+    rsa.setCrtThreads(opts.crtThreads);
 
     printf("Using the following keys:\n");
-    rsa.d = 7;
     rsa.printKeys();
 
-    teste();
+    typename RsaN::num check = rsa.sign(1283);
+    std::cout << check << std::endl;
+    if (!rsa.verify(1283, check)) {
+        printf("Warning! The signature of 1283 does not verify with the public key\n");
+    }
+
+    switch (opts.expType) {
+        case POWERLADDER:
+            sign_messages<Limbs, POWERLADDER>(rsa, opts);
+            break;
+        case BARRETT_LADDER:
+            sign_messages<Limbs, BARRETT_LADDER>(rsa, opts);
+            break;
+        case MODEXP:
+            sign_messages<Limbs, MODEXP>(rsa, opts);
+            break;
+        case MODEXP_SLEEP:
+            sign_messages<Limbs, MODEXP_SLEEP>(rsa, opts);
+            break;
+        case MODEXP_CRT:
+            sign_messages<Limbs, MODEXP_CRT>(rsa, opts);
+            break;
+        case SLIDING_WINDOW:
+            sign_messages<Limbs, SLIDING_WINDOW>(rsa, opts);
+            break;
+        case FIXED_WINDOW:
+            sign_messages<Limbs, FIXED_WINDOW>(rsa, opts);
+            break;
+        case MONTGOMERY_LADDER:
+            sign_messages<Limbs, MONTGOMERY_LADDER>(rsa, opts);
+            break;
+    }
+    return 0;
+}
 
+void usage(){
+    printf("Usage: ./rsa-server <p> <q> <e> <message count> [options]\n");
+    printf("       ./rsa-server --to-csv <data.bin> [data.csv]\n");
+    printf("       ./rsa-server --keygen <bits> [e] [--threads <n>] [--seed <s>]\n");
+    printf("       ./rsa-server --client <host> <port> <message count> [--inflight <n>] [--rate <r>]\n");
+    printf("                    [--timeout <ms>] [--no-kernel-stamps] [--stop-server] [--seed <s>]\n");
+    printf("                    [--format <f>] [--timer <t>]\n");
+    printf("Signs <message count> random messages, and saves the result to a CSV file\n");
+    printf("or a binary dataset, which --to-csv converts back to CSV.\n");
+    printf("--keygen prints a new key with a <bits> bit modulus (40 to 4096) and e (default 65537),\n");
+    printf("searching for the primes on n threads (default one per core)\n");
+    printf("--client has a --serve server sign <message count> random messages, with up to n\n");
+    printf("requests (default 64) in flight, sent at r requests/s (default as fast as possible),\n");
+    printf("and saves them with the round trips like the local signatures,\n");
+    printf("--stop-server then tells the server to stop\n");
+    printf("Options:\n");
+    printf("  --bits <512|1024|2048|4096>  key size to compile for (default 1024)\n");
+    printf("  --exp <modexp|modexp_sleep|powerladder|barrettladder|montladder|crt|sliding|fixed>\n");
+    printf("                               exponentiation method (default modexp_sleep)\n");
+    printf("  --crt-threads                run the two CRT exponentiations on two threads\n");
+    printf("  --threads <n>                sign on n threads, each pinned to its own core\n");
+    printf("  --seed <s>                   seed for the random messages (default: time)\n");
+    printf("  --simulate <ns>              modexp_sleep adds <ns> per subtraction to the duration\n");
+    printf("                               instead of sleeping\n");
+    printf("  --jitter <ns>                standard deviation of each simulated sleep\n");
+    printf("  --simulate-only              record only the simulated time, for deterministic datasets\n");
+    printf("  --format <csv|binary>        write data.csv (default), or the binary data.bin\n");
+    printf("  --async-writer               write the samples on a writer thread while signing\n");
+    printf("  --repeat <k>                 sign every message k times, and record the median,\n");
+    printf("                               minimum and MAD of the durations\n");
+    printf("  --warmup <w>                 untimed signatures of every message before the timed ones\n");
+    printf("  --pregenerate                draw all messages into a pool before signing\n");
+    printf("  --timer <system|steady|tsc|cntvct>\n");
+    printf("                               clock to time the signatures with (default steady)\n");
+    printf("  --serve <port>               sign the messages of UDP clients instead (Linux only),\n");
+    printf("                               until interrupted or stopped, logging the first <message count>\n");
+}
 
-    timed_sign(atoi(argv[4]));
+/*
+ * Generates a key with a bits bit modulus in a num of the smallest size that
+ * holds it, and prints it.
+ */
+template<ttmath::uint Limbs>
+int keygen(long bits, const char *e, int threads, unsigned long seed){
+    typedef Rsa<Limbs> RsaN;
+    typename RsaN::num exponent;
+    const char *end = e;
+    bool read = false;
+    // p-1 and q-1 are even, so an even e has no inverse and no key
+    if (exponent.FromString(e, 10, &end, &read) || !read || *end || exponent < 3
+        || !exponent.IsTheLowestBitSet()) {
+        printf("e must be an odd number of at least 3, not %s\n", e);
+        return 1;
+    }
+    Xoshiro256 rng(seed);
+    ThreadPool pool(threads);
+    printf("Generating a %ld bit key on %d thread(s)\n", bits, pool.size());
+    auto start = std::chrono::steady_clock::now();
+    RsaN rsa;
+    generateKey<Limbs>(bits, exponent, pool, rng, rsa);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("Done in %.2f s\n", elapsed.count());
+    rsa.printKeys();
     return 0;
 }
 
+int keygen(int argc, const char * argv[]){
+    long bits = atol(argv[2]);
+    const char *e = "65537";
+    int threads = 0;
+    unsigned long seed = time(NULL);
+    int i = 3;
+    if (i < argc && argv[i][0] != '-') {
+        e = argv[i++];
+    }
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    loadTuning();
+    if (bits < 40) {
+        usage();
+        return 1;
+    }
+    if (bits <= 512) return keygen<RSA_LIMBS(512)>(bits, e, threads, seed);
+    if (bits <= 1024) return keygen<RSA_LIMBS(1024)>(bits, e, threads, seed);
+    if (bits <= 2048) return keygen<RSA_LIMBS(2048)>(bits, e, threads, seed);
+    if (bits <= 4096) return keygen<RSA_LIMBS(4096)>(bits, e, threads, seed);
+    usage();
+    return 1;
+}
 
 /*
- * Generate @messageCount random messages, sign them, and return the time it took.
- * It reads UDP datagrams for messages, signs the message and sends back
- * the signature on the same port.
+ * Collects opts.messageCount signatures of random messages from a server whose
+ * key the query returned, and writes them to data.csv or data.bin like
+ * timed_sign, with the round trip the client measured as the duration, and the
+ * server duration and the requests in flight in the client columns.
+ * The receive loop only decodes the samples into the blocks of an AsyncWriter,
+ * which never waits for the writer thread, so the answers that arrive meanwhile
+ * are not stamped late, and the writer thread checks every signature with the
+ * public key and writes it.
  */
-void timed_sign(const int messageCount){
-    printf("Signing %d random messages (this could take a while)....\n", messageCount);
-    std::ofstream csvfile;
+template<ttmath::uint Limbs>
+int collect(client::Pipeline &pipeline, const std::vector<unsigned char> &key, const Options &opts,
+            const Timer &timer){
+    typedef Rsa<Limbs> RsaN;
+    const uint32_t words = dataset::wordsFor<Limbs>();
+    typename RsaN::num n, e;
+    dataset::getNum(&key[protocol::IdBytes + 8], words, n);
+    dataset::getNum(&key[protocol::IdBytes + 8 + 8 * words], words, e);
+    printf("Server key: %ld bit N = %s, E = %s\n", RsaN::numBits(n), n.ToString().c_str(), e.ToString().c_str());
 
-    csvfile.open("data.csv");
-    csvfile << "N,E" << std::endl;
-    csvfile << rsa.n << "," << rsa.e << std::endl;
-    csvfile << "message,signature,duration" << std::endl;
-    timepoint start, end;
-    num message;
-    TimedSignature current;
-    for (int i = 0; i < messageCount; i++) {
-        // Generate a random message between 0 and the modulus.
-        message = bigrand(rsa.n);
-        current.message = message;
-        start = std::chrono::system_clock::now();
-        current.signed_message = rsa.sign(message);
-        end = std::chrono::system_clock::now();
-        current.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
-        csvfile << current << "\n";
-    }
-    csvfile.close();
+    SampleSink<Limbs> sink;
+    if (!sink.open(opts, n, e, timer)) {
+        printf("Could not open the output file\n");
+        return 1;
+    }
+    sink.verifyWith(n, e);
+    AsyncWriter<Limbs> async(sink, 1, AsyncBlockSize, true);
+    std::thread writerThread(write_worker<Limbs>, &async, 1, opts.pin);
+
+    double serverTotal = 0, roundTripTotal = 0;
+    Xoshiro256 rng(opts.seed);
+    client::Report report = pipeline.run(uint64_t(opts.messageCount), protocol::signRequestBytes(words) - protocol::IdBytes,
+                                         protocol::signResponseBytes(words) - protocol::IdBytes,
+        [&](unsigned char *body){
+            dataset::putNum(body, bigrand(n, rng));
+        },
+        [&](const unsigned char *body, const unsigned char *response, size_t, int64_t roundTrip, client::StampSource,
+            uint32_t inflight){
+            TimedSignature<Limbs> &current = async.slot(0);
+            dataset::getNum(body, words, current.message);
+            dataset::getNum(response, words, current.signed_message);
+            current.duration = std::chrono::nanoseconds(roundTrip);
+            current.min = current.mad = std::chrono::nanoseconds(0);
+            current.stats.reset();
+            current.server = std::chrono::nanoseconds(int64_t(dataset::get64(response + 8 * words)));
+            current.inflight = inflight;
+            async.commit(0);
+            serverTotal += current.server.count();
+            roundTripTotal += roundTrip;
+        });
+    async.finish(0);
+    writerThread.join();
+    if (!sink.close()) {
+        printf("Could not write the output file\n");
+        return 1;
+    }
+
+    const uint64_t answered = report.sources[0] + report.sources[1] + report.sources[2];
+    printf("%llu signatures in %.2f s (%.0f/s), %llu requests sent, %llu lost\n", (unsigned long long)answered,
+           report.seconds, answered / report.seconds, (unsigned long long)report.sent, (unsigned long long)report.lost);
+    for (int s = 0; s < client::StampSources; s++) {
+        if (report.sources[s] > 0) {
+            printf("  %llu timed with %s timestamps\n", (unsigned long long)report.sources[s],
+                   client::Pipeline::name(client::StampSource(s)));
+        }
+    }
+    if (report.stalls > 0) {
+        printf("Warning! %llu requests were sent late, with all requests in flight out or the send buffer full\n",
+               (unsigned long long)report.stalls);
+    }
+    if (answered > 0) {
+        printf("Mean round trip %.0f ns, of which %.0f ns on the server\n", roundTripTotal / answered,
+               serverTotal / answered);
+    }
+    if (sink.invalidSignatures() > 0) {
+        printf("Warning! %llu signatures do not verify with the public key\n",
+               (unsigned long long)sink.invalidSignatures());
+    }
     printf("done.\n");
-}
\ No newline at end of file
+    return 0;
+}
+
+int collect(int argc, const char * argv[]){
+    Options opts;
+    opts.messageCount = atoi(argv[4]);
+    opts.pin = false;
+    opts.client = true;
+    opts.seed = time(NULL);
+    opts.binary = false;
+    opts.timer = TIMER_STEADY;
+    opts.repeat = 1;
+    opts.warmup = 0;
+    bool stopServer = false;
+    client::Settings settings;
+    settings.inflight = 64;
+    settings.rate = 0;
+    settings.timeoutMs = 1000;
+    settings.kernelStamps = true;
+    for (int i = 5; i < argc; i++) {
+        if (!strcmp(argv[i], "--inflight") && i + 1 < argc) {
+            settings.inflight = atoi(argv[++i]);
+            if (settings.inflight < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            settings.rate = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+            settings.timeoutMs = atoi(argv[++i]);
+            if (settings.timeoutMs < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--no-kernel-stamps")) {
+            settings.kernelStamps = false;
+        }
+        else if (!strcmp(argv[i], "--stop-server")) {
+            stopServer = true;
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--timer") && i + 1 < argc) {
+            if (!Timer::parse(argv[++i], opts.timer)) { usage(); return 1; }
+            if (!Timer::available(opts.timer)) {
+                printf("The %s timer is not available on this machine\n", Timer::name(opts.timer));
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (!strcmp(name, "csv")) opts.binary = false;
+            else if (!strcmp(name, "binary")) opts.binary = true;
+            else { usage(); return 1; }
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (opts.messageCount < 1) {
+        usage();
+        return 1;
+    }
+
+    const Timer timer(opts.timer);
+    client::Pipeline pipeline(timer, settings);
+    if (!pipeline.connect(argv[2], atoi(argv[3]))) {
+        return 1;
+    }
+    printf("Timing with %s, %d requests in flight", pipeline.kernelStamps() ? "SO_TIMESTAMPING" : Timer::name(timer.source),
+           settings.inflight);
+    if (settings.rate > 0) {
+        printf(" at %.0f requests/s", settings.rate);
+    }
+    printf("\n");
+    std::vector<unsigned char> key;
+    if (!pipeline.query(NULL, 0, key) || key.size() < protocol::IdBytes + 8) {
+        printf("No key from %s:%s\n", argv[2], argv[3]);
+        return 1;
+    }
+    const uint32_t words = dataset::get32(&key[protocol::IdBytes]);
+    if (key.size() != protocol::keyResponseBytes(words)) {
+        printf("Malformed key from %s:%s\n", argv[2], argv[3]);
+        return 1;
+    }
+    loadTuning();
+    int result = 1;
+    if (words == dataset::wordsFor<RSA_LIMBS(512)>()) result = collect<RSA_LIMBS(512)>(pipeline, key, opts, timer);
+    else if (words == dataset::wordsFor<RSA_LIMBS(1024)>()) result = collect<RSA_LIMBS(1024)>(pipeline, key, opts, timer);
+    else if (words == dataset::wordsFor<RSA_LIMBS(2048)>()) result = collect<RSA_LIMBS(2048)>(pipeline, key, opts, timer);
+    else if (words == dataset::wordsFor<RSA_LIMBS(4096)>()) result = collect<RSA_LIMBS(4096)>(pipeline, key, opts, timer);
+    else printf("The server uses %u word numbers, which csv is not built for\n", words);
+    if (stopServer) {
+        unsigned char magic[8];
+        dataset::put64(magic, protocol::StopMagic);
+        std::vector<unsigned char> response;
+        if (!pipeline.query(magic, sizeof(magic), response) || response.size() != protocol::StopRequestBytes) {
+            printf("The server did not confirm the stop request\n");
+            return 1;
+        }
+        printf("Server stopped.\n");
+    }
+    return result;
+}
+
+int main(int argc, const char * argv[]) {
+
+    if (argc >= 3 && !strcmp(argv[1], "--to-csv")) {
+        return dataset::toCsv(argv[2], argc >= 4 ? argv[3] : "data.csv");
+    }
+    if (argc >= 3 && !strcmp(argv[1], "--keygen")) {
+        return keygen(argc, argv);
+    }
+    if (argc >= 5 && !strcmp(argv[1], "--client")) {
+        return collect(argc, argv);
+    }
+    if (argc < 5) {
+        usage();
+        return 1;
+    }
+
+    Options opts;
+    opts.p = argv[1];
+    opts.q = argv[2];
+    opts.e = argv[3];
+    opts.messageCount = atoi(argv[4]);
+    opts.bits = 1024;
+    opts.expType = MODEXP_SLEEP;
+    opts.crtThreads = false;
+    opts.threads = 1;
+    opts.pin = false;
+    opts.seed = time(NULL); // Seed the RNG
+    opts.simulatePenalty = 0;
+    opts.simulateJitter = 0;
+    opts.simulateOnly = false;
+    opts.binary = false;
+    opts.asyncWriter = false;
+    opts.timer = TIMER_STEADY;
+    opts.repeat = 1;
+    opts.warmup = 0;
+    opts.pregenerate = false;
+    opts.servePort = 0;
+    opts.client = false;
+    for (int i = 5; i < argc; i++) {
+        if (!strcmp(argv[i], "--bits") && i + 1 < argc) {
+            opts.bits = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--exp") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (!strcmp(name, "modexp")) opts.expType = MODEXP;
+            else if (!strcmp(name, "modexp_sleep")) opts.expType = MODEXP_SLEEP;
+            else if (!strcmp(name, "powerladder")) opts.expType = POWERLADDER;
+            else if (!strcmp(name, "barrettladder")) opts.expType = BARRETT_LADDER;
+            else if (!strcmp(name, "montladder")) opts.expType = MONTGOMERY_LADDER;
+            else if (!strcmp(name, "crt")) opts.expType = MODEXP_CRT;
+            else if (!strcmp(name, "sliding")) opts.expType = SLIDING_WINDOW;
+            else if (!strcmp(name, "fixed")) opts.expType = FIXED_WINDOW;
+            else { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--crt-threads")) {
+            opts.crtThreads = true;
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = atoi(argv[++i]);
+            opts.pin = true;
+            if (opts.threads < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--simulate") && i + 1 < argc) {
+            opts.simulatePenalty = atoll(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--jitter") && i + 1 < argc) {
+            opts.simulateJitter = atoll(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--simulate-only")) {
+            opts.simulateOnly = true;
+        }
+        else if (!strcmp(argv[i], "--timer") && i + 1 < argc) {
+            if (!Timer::parse(argv[++i], opts.timer)) { usage(); return 1; }
+            if (!Timer::available(opts.timer)) {
+                printf("The %s timer is not available on this machine\n", Timer::name(opts.timer));
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            opts.repeat = atoi(argv[++i]);
+            if (opts.repeat < 1) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            opts.warmup = atoi(argv[++i]);
+            if (opts.warmup < 0) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--pregenerate")) {
+            opts.pregenerate = true;
+        }
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+            opts.servePort = atoi(argv[++i]);
+            if (opts.servePort < 1 || opts.servePort > 65535) { usage(); return 1; }
+        }
+        else if (!strcmp(argv[i], "--async-writer")) {
+            opts.asyncWriter = true;
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (!strcmp(name, "csv")) opts.binary = false;
+            else if (!strcmp(name, "binary")) opts.binary = true;
+            else { usage(); return 1; }
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    switch (opts.expType) {
+        case POWERLADDER:
+            printf("Using Montgomery Powering Ladder for exponentiation\n");
+            break;
+        case BARRETT_LADDER:
+            printf("Using Montgomery Powering Ladder with Barrett reduction for exponentiation\n");
+            break;
+        case MONTGOMERY_LADDER:
+            printf("Using Montgomery Powering Ladder in the Montgomery domain for exponentiation\n");
+            break;
+        case MODEXP:
+            printf("Using Montgomery for exponentiation\n");
+            break;
+        case MODEXP_SLEEP:
+            if (opts.simulatePenalty > 0) {
+                printf("Using Montgomery with simulated (%lld ns) sleep for exponentiation\n", opts.simulatePenalty);
+            }
+            else {
+                printf("Using Montgomery with (2ms) sleep for exponentiation\n");
+            }
+            break;
+        case MODEXP_CRT:
+            printf("Using Montgomery with CRT for exponentiation\n");
+            break;
+        case SLIDING_WINDOW:
+            printf("Using Montgomery with sliding window for exponentiation\n");
+            break;
+        case FIXED_WINDOW:
+            printf("Using Montgomery with constant time fixed window for exponentiation\n");
+            break;
+    }
+
+    loadTuning();
+    switch (opts.bits) {
+        case 512:  return run<RSA_LIMBS(512)>(opts);
+        case 1024: return run<RSA_LIMBS(1024)>(opts);
+        case 2048: return run<RSA_LIMBS(2048)>(opts);
+        case 4096: return run<RSA_LIMBS(4096)>(opts);
+        default:
+            usage();
+            return 1;
+    }
+}
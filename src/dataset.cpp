@@ -0,0 +1,210 @@
+//
+//  dataset.cpp
+//  rsa
+//
+//  Binary columnar format for the timing datasets.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+
+#include "dataset.h"
+#include "rsa.h"
+#include "timer.h"
+
+namespace dataset {
+
+std::vector<unsigned char> encodeHeader(const Header &h){
+    std::vector<unsigned char> bytes(h.messageOffset, 0);
+    memcpy(&bytes[0], Magic, sizeof(Magic));
+    put32(&bytes[8], h.version);
+    put32(&bytes[12], h.words);
+    put32(&bytes[16], h.keyBits);
+    put32(&bytes[20], h.limbs);
+    put64(&bytes[24], h.count);
+    put64(&bytes[32], h.messageOffset);
+    put64(&bytes[40], h.signatureOffset);
+    put64(&bytes[48], h.durationOffset);
+    put64(&bytes[56], h.capacity);
+    put32(&bytes[64], h.timer);
+    put32(&bytes[68], h.repeat);
+    put64(&bytes[72], h.timerFrequency);
+    put64(&bytes[80], h.timerOverhead);
+    put64(&bytes[88], h.minOffset);
+    put64(&bytes[96], h.madOffset);
+    put32(&bytes[104], h.warmup);
+    put64(&bytes[112], h.statsOffset);
+    put64(&bytes[120], h.clientOffset);
+    for (uint32_t i = 0; i < h.words; i++) {
+        put64(&bytes[FixedHeaderSize + 8*i], h.n[i]);
+        put64(&bytes[FixedHeaderSize + 8*(h.words + i)], h.e[i]);
+    }
+    return bytes;
+}
+
+bool readHeader(std::istream &in, Header &h){
+    unsigned char fixed[FixedHeaderSize] = {0};
+    if (!in.read((char*)fixed, FixedHeaderSizeV1) || memcmp(fixed, Magic, sizeof(Magic))) {
+        printf("Not a dataset file\n");
+        return false;
+    }
+    h.version = get32(&fixed[8]);
+    h.words = get32(&fixed[12]);
+    h.keyBits = get32(&fixed[16]);
+    h.limbs = get32(&fixed[20]);
+    h.count = get64(&fixed[24]);
+    h.messageOffset = get64(&fixed[32]);
+    h.signatureOffset = get64(&fixed[40]);
+    h.durationOffset = get64(&fixed[48]);
+    h.capacity = get64(&fixed[56]);
+    if (h.version != 1 && h.version != Version) {
+        printf("Unsupported dataset version %u\n", h.version);
+        return false;
+    }
+    const size_t fixedSize = (h.version == 1) ? FixedHeaderSizeV1 : FixedHeaderSize;
+    if (fixedSize > FixedHeaderSizeV1 && !in.read((char*)fixed + FixedHeaderSizeV1, fixedSize - FixedHeaderSizeV1)) {
+        printf("Truncated dataset header\n");
+        return false;
+    }
+    h.timer = get32(&fixed[64]);
+    h.timerFrequency = get64(&fixed[72]);
+    h.timerOverhead = get64(&fixed[80]);
+    h.repeat = get32(&fixed[68]);
+    h.minOffset = get64(&fixed[88]);
+    h.madOffset = get64(&fixed[96]);
+    h.warmup = get32(&fixed[104]);
+    h.statsOffset = get64(&fixed[112]);
+    h.clientOffset = get64(&fixed[120]);
+    if (h.words == 0 || h.count > h.capacity || h.messageOffset < fixedSize + 16 * uint64_t(h.words)) {
+        printf("Corrupt dataset header\n");
+        return false;
+    }
+    std::vector<unsigned char> keys(16 * h.words);
+    if (!in.read((char*)&keys[0], keys.size())) {
+        printf("Truncated dataset header\n");
+        return false;
+    }
+    h.n.resize(h.words);
+    h.e.resize(h.words);
+    for (uint32_t i = 0; i < h.words; i++) {
+        h.n[i] = get64(&keys[8*i]);
+        h.e[i] = get64(&keys[8*(h.words + i)]);
+    }
+    return true;
+}
+
+/*
+ * Writes the dataset as CSV, with numbers held in a UInt<Limbs>.
+ * Reads a chunk of rows from each column at a time.
+ */
+template<ttmath::uint Limbs>
+static int writeCsv(std::ifstream &in, const Header &h, const char *csvPath){
+    typedef ttmath::UInt<Limbs> num;
+    const uint64_t rowBytes = 8 * uint64_t(h.words);
+    const uint64_t chunkRows = 4096;
+
+    std::vector<unsigned char> word(8 * h.words);
+    num n, e;
+    for (uint32_t i = 0; i < h.words; i++) put64(&word[8*i], h.n[i]);
+    getNum(&word[0], h.words, n);
+    for (uint32_t i = 0; i < h.words; i++) put64(&word[8*i], h.e[i]);
+    getNum(&word[0], h.words, e);
+
+    std::ofstream csvfile(csvPath);
+    if (!csvfile) {
+        printf("Could not open %s for writing\n", csvPath);
+        return 1;
+    }
+    csvfile << "N,E" << std::endl;
+    csvfile << n << "," << e << std::endl;
+    const bool aggregates = h.minOffset && h.madOffset;
+    csvfile << (aggregates ? "message,signature,duration,min,mad" : "message,signature,duration");
+    if (h.statsOffset) {
+        for (int c = 0; c < StatsColumns; c++) {
+            csvfile << "," << StatsColumnNames[c];
+        }
+    }
+    for (int c = 0; h.clientOffset && c < ClientColumns; c++) {
+        csvfile << "," << ClientColumnNames[c];
+    }
+    csvfile << std::endl;
+
+    std::vector<unsigned char> messages(chunkRows * rowBytes), signatures(chunkRows * rowBytes), durations(chunkRows * 8);
+    std::vector<unsigned char> mins(chunkRows * 8), mads(chunkRows * 8), counts(StatsColumns * chunkRows * 8);
+    std::vector<unsigned char> clients(ClientColumns * chunkRows * 8);
+    num message, signature;
+    for (uint64_t first = 0; first < h.count; first += chunkRows) {
+        uint64_t rows = std::min(chunkRows, h.count - first);
+        in.seekg(h.messageOffset + first * rowBytes);
+        in.read((char*)&messages[0], rows * rowBytes);
+        in.seekg(h.signatureOffset + first * rowBytes);
+        in.read((char*)&signatures[0], rows * rowBytes);
+        in.seekg(h.durationOffset + first * 8);
+        in.read((char*)&durations[0], rows * 8);
+        if (aggregates) {
+            in.seekg(h.minOffset + first * 8);
+            in.read((char*)&mins[0], rows * 8);
+            in.seekg(h.madOffset + first * 8);
+            in.read((char*)&mads[0], rows * 8);
+        }
+        for (int c = 0; h.statsOffset && c < StatsColumns; c++) {
+            in.seekg(statsColumnOffset(h, c) + first * 8);
+            in.read((char*)&counts[c * chunkRows * 8], rows * 8);
+        }
+        for (int c = 0; h.clientOffset && c < ClientColumns; c++) {
+            in.seekg(clientColumnOffset(h, c) + first * 8);
+            in.read((char*)&clients[c * chunkRows * 8], rows * 8);
+        }
+        if (!in) {
+            printf("Truncated dataset\n");
+            return 1;
+        }
+        for (uint64_t i = 0; i < rows; i++) {
+            getNum(&messages[i * rowBytes], h.words, message);
+            getNum(&signatures[i * rowBytes], h.words, signature);
+            csvfile << message << "," << signature << "," << (int64_t)get64(&durations[8*i]);
+            if (aggregates) {
+                csvfile << "," << (int64_t)get64(&mins[8*i]) << "," << (int64_t)get64(&mads[8*i]);
+            }
+            for (int c = 0; h.statsOffset && c < StatsColumns; c++) {
+                csvfile << "," << (unsigned long long)get64(&counts[(c * chunkRows + i) * 8]);
+            }
+            for (int c = 0; h.clientOffset && c < ClientColumns; c++) {
+                csvfile << "," << (int64_t)get64(&clients[(c * chunkRows + i) * 8]);
+            }
+            csvfile << "\n";
+        }
+    }
+    csvfile.close();
+    return csvfile ? 0 : 1;
+}
+
+int toCsv(const char *binPath, const char *csvPath){
+    std::ifstream in(binPath, std::ios::in | std::ios::binary);
+    if (!in) {
+        printf("Could not open %s\n", binPath);
+        return 1;
+    }
+    Header h;
+    if (!readHeader(in, h)) {
+        return 1;
+    }
+    if (h.timerFrequency) {
+        printf("Durations measured with the %s timer (%llu Hz), %.1f ns overhead subtracted\n",
+               Timer::name(TimerSource(h.timer)), (unsigned long long)h.timerFrequency, h.timerOverhead / 1000.0);
+    }
+    if (h.repeat > 1) {
+        printf("Every message was signed %u times after %u warmup signatures\n", h.repeat, h.warmup);
+    }
+    // Pick the smallest key size the signer is instantiated for that holds the numbers.
+    const uint64_t bits = 64 * uint64_t(h.words);
+    if (bits <= 512) return writeCsv<RSA_LIMBS(512)>(in, h, csvPath);
+    if (bits <= 1024) return writeCsv<RSA_LIMBS(1024)>(in, h, csvPath);
+    if (bits <= 2048) return writeCsv<RSA_LIMBS(2048)>(in, h, csvPath);
+    if (bits <= 4096) return writeCsv<RSA_LIMBS(4096)>(in, h, csvPath);
+    printf("Numbers of %llu bits are too large\n", (unsigned long long)bits);
+    return 1;
+}
+
+} // namespace dataset
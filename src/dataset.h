@@ -0,0 +1,425 @@
+//
+//  dataset.h
+//  rsa
+//
+//  Binary columnar format for the timing datasets.
+//
+
+#ifndef __rsa__dataset__
+#define __rsa__dataset__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "lib/ttmath.h"
+
+/*
+ * Layout of a dataset file. Everything is little endian, and every
+ * section starts on a 64 byte boundary, so the file can be mmapped and
+ * the columns used as arrays:
+ *
+ *   offset 0   magic "RSATIME\0"
+ *          8   uint32 version (2)
+ *         12   uint32 words, 64 bit words per number
+ *         16   uint32 keyBits, number of bits in N
+ *         20   uint32 limbs, ttmath limbs per number in the signer
+ *         24   uint64 count, number of samples
+ *         32   uint64 offset of the message column
+ *         40   uint64 offset of the signature column
+ *         48   uint64 offset of the duration column
+ *         56   uint64 capacity, samples the columns have room for
+ *         64   uint32 timer, the TimerSource the durations were measured with
+ *         68   uint32 repeat, timed signatures per message (0 or 1: one)
+ *         72   uint64 timer frequency, ticks per second
+ *         80   uint64 timer overhead in picoseconds, subtracted from every duration
+ *         88   uint64 offset of the min column, 0 if there is none
+ *         96   uint64 offset of the mad column, 0 if there is none
+ *        104   uint32 warmup, untimed signatures per message before the timed ones
+ *        108   reserved (0)
+ *        112   uint64 offset of the first operation count column, 0 if there are none
+ *        120   uint64 offset of the first client column, 0 if there are none
+ *        128   N, words 64 bit words
+ *              E, words 64 bit words
+ *
+ * The message and signature columns hold capacity numbers of words 64 bit
+ * words each, least significant word first. The duration column holds
+ * capacity int64 durations in nanoseconds. Only the first count rows are used.
+ * When every message was signed repeat > 1 times, the duration is the median,
+ * and the min and mad (median absolute deviation) columns follow, also int64 ns.
+ * A signer built with RSA_STATS adds StatsColumns uint64 columns of operation
+ * counts per signature, named by StatsColumnNames, one after the other from
+ * the first one's offset, each aligned (see statsColumnOffset).
+ * A dataset collected by csv --client adds ClientColumns int64 columns after
+ * them, named by ClientColumnNames, laid out the same way (clientColumnOffset):
+ * the duration the server measured for each signature, which the round trip in
+ * the duration column includes, and the number of other requests in flight
+ * when the request was sent.
+ *
+ * Version 1 files have no timer fields, and N starts at offset 64.
+ */
+namespace dataset {
+
+const char Magic[8] = {'R', 'S', 'A', 'T', 'I', 'M', 'E', 0};
+const uint32_t Version = 2;
+const uint64_t Alignment = 64;
+const size_t FixedHeaderSize = 128;
+const size_t FixedHeaderSizeV1 = 64;
+
+const int StatsColumns = 5;
+const char *const StatsColumnNames[StatsColumns] = {
+    "products", "squarings", "subtractions", "square_cycles", "multiply_cycles"
+};
+
+const int ClientColumns = 2;
+const char *const ClientColumnNames[ClientColumns] = {
+    "server_duration", "inflight"
+};
+
+struct Header {
+    uint32_t version;
+    uint32_t words;
+    uint32_t keyBits;
+    uint32_t limbs;
+    uint64_t count;
+    uint64_t messageOffset;
+    uint64_t signatureOffset;
+    uint64_t durationOffset;
+    uint64_t capacity;
+    uint32_t timer;
+    uint64_t timerFrequency;
+    uint64_t timerOverhead;     // picoseconds
+    uint32_t repeat, warmup;
+    uint64_t minOffset, madOffset;
+    uint64_t statsOffset;
+    uint64_t clientOffset;
+    std::vector<uint64_t> n, e;
+};
+
+inline uint64_t align(uint64_t offset){
+    return (offset + Alignment - 1) / Alignment * Alignment;
+}
+
+/*
+ * Offset of operation count column i, or 0 if the file has none.
+ */
+inline uint64_t statsColumnOffset(const Header &h, int i){
+    return h.statsOffset ? h.statsOffset + uint64_t(i) * align(h.capacity * 8) : 0;
+}
+
+/*
+ * Offset of client column i, or 0 if the file has none.
+ */
+inline uint64_t clientColumnOffset(const Header &h, int i){
+    return h.clientOffset ? h.clientOffset + uint64_t(i) * align(h.capacity * 8) : 0;
+}
+
+inline void put32(unsigned char *p, uint32_t v){
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i));
+}
+
+inline void put64(unsigned char *p, uint64_t v){
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8*i));
+}
+
+inline uint32_t get32(const unsigned char *p){
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+inline uint64_t get64(const unsigned char *p){
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * Number of 64 bit words a UInt<Limbs> is stored in.
+ */
+template<ttmath::uint Limbs>
+inline uint32_t wordsFor(){
+    return (Limbs * TTMATH_BITS_PER_UINT + 63) / 64;
+}
+
+/*
+ * Stores x as little endian 64 bit words at p.
+ */
+template<ttmath::uint Limbs>
+void putNum(unsigned char *p, const ttmath::UInt<Limbs> &x){
+#if TTMATH_BITS_PER_UINT == 64
+    for (ttmath::uint i = 0; i < Limbs; i++) {
+        put64(p + 8*i, x.table[i]);
+    }
+#else
+    for (ttmath::uint i = 0; i < Limbs; i++) {
+        put32(p + 4*i, x.table[i]);
+    }
+    if (Limbs % 2) {
+        put32(p + 4*Limbs, 0);
+    }
+#endif
+}
+
+/*
+ * Reads a number of words 64 bit words from p into x, which must be wide enough.
+ */
+template<ttmath::uint Limbs>
+void getNum(const unsigned char *p, uint32_t words, ttmath::UInt<Limbs> &x){
+    x.SetZero();
+#if TTMATH_BITS_PER_UINT == 64
+    for (ttmath::uint i = 0; i < words && i < Limbs; i++) {
+        x.table[i] = get64(p + 8*i);
+    }
+#else
+    for (ttmath::uint i = 0; i < 2*words && i < Limbs; i++) {
+        x.table[i] = get32(p + 4*i);
+    }
+#endif
+}
+
+/*
+ * Encodes the fixed header, N and E, padded to the first column.
+ */
+std::vector<unsigned char> encodeHeader(const Header &h);
+
+/*
+ * Reads and checks the header of a dataset file.
+ * Returns false, with a message on stdout, if it is not a valid dataset.
+ */
+bool readHeader(std::istream &in, Header &h);
+
+/*
+ * Converts the dataset at binPath to the CSV format of data.csv.
+ * Returns 0 on success.
+ */
+int toCsv(const char *binPath, const char *csvPath);
+
+/*
+ * Streams samples into a dataset file.
+ *
+ * The columns are laid out for capacity samples when the file is opened,
+ * and the samples are buffered per column and written a chunk at a time,
+ * so appending does no formatting and no per sample I/O.
+ * close() writes the final count into the header.
+ */
+template<ttmath::uint Limbs>
+class Writer {
+public:
+    typedef ttmath::UInt<Limbs> num;
+    static const uint64_t ChunkRows = 4096;
+
+    Writer():rowBytes(wordsFor<Limbs>() * 8),count(0),flushed(0),capacity(0){
+        header.timer = 0;
+        header.timerFrequency = header.timerOverhead = 0;
+        header.repeat = 1;
+        header.warmup = 0;
+        stats = client = false;
+    }
+    ~Writer(){ close(); }
+
+    /*
+     * Records the clock the durations are measured with. Call before close().
+     */
+    void setTimer(uint32_t source, uint64_t frequency, uint64_t overheadPs){
+        header.timer = source;
+        header.timerFrequency = frequency;
+        header.timerOverhead = overheadPs;
+    }
+
+    /*
+     * Records how often every message was signed. With repeat > 1 the
+     * min and mad columns are added. Call before open().
+     */
+    void setRepeat(uint32_t repeat, uint32_t warmup){
+        header.repeat = repeat;
+        header.warmup = warmup;
+    }
+
+    /*
+     * Adds the operation count columns. Call before open().
+     */
+    void setStats(bool stats){
+        this->stats = stats;
+    }
+
+    /*
+     * Adds the client columns. Call before open().
+     */
+    void setClient(bool client){
+        this->client = client;
+    }
+
+    /*
+     * Creates the file, with room for capacity samples.
+     */
+    bool open(const char *path, const num &n, const num &e, long keyBits, uint64_t capacity){
+        file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            printf("Could not open %s for writing\n", path);
+            return false;
+        }
+        header.version = Version;
+        header.words = wordsFor<Limbs>();
+        header.keyBits = (uint32_t)keyBits;
+        header.limbs = Limbs;
+        header.count = 0;
+        header.capacity = capacity;
+        this->capacity = capacity;
+        header.n.assign(header.words, 0);
+        header.e.assign(header.words, 0);
+        std::vector<unsigned char> word(rowBytes);
+        putNum(&word[0], n);
+        for (uint32_t i = 0; i < header.words; i++) header.n[i] = get64(&word[8*i]);
+        putNum(&word[0], e);
+        for (uint32_t i = 0; i < header.words; i++) header.e[i] = get64(&word[8*i]);
+        header.messageOffset = align(FixedHeaderSize + 2 * rowBytes);
+        header.signatureOffset = align(header.messageOffset + capacity * rowBytes);
+        header.durationOffset = align(header.signatureOffset + capacity * rowBytes);
+        header.minOffset = header.madOffset = header.statsOffset = header.clientOffset = 0;
+        if (header.repeat > 1) {
+            header.minOffset = align(header.durationOffset + capacity * 8);
+            header.madOffset = align(header.minOffset + capacity * 8);
+        }
+        if (stats) {
+            header.statsOffset = align((header.madOffset ? header.madOffset : header.durationOffset) + capacity * 8);
+        }
+        if (client) {
+            header.clientOffset = align(columnsEnd());
+        }
+        count = flushed = 0;
+        std::vector<unsigned char> bytes = encodeHeader(header);
+        file.write((const char*)&bytes[0], bytes.size());
+        messages.resize(ChunkRows * rowBytes);
+        signatures.resize(ChunkRows * rowBytes);
+        durations.resize(ChunkRows * 8);
+        if (header.repeat > 1) {
+            mins.resize(ChunkRows * 8);
+            mads.resize(ChunkRows * 8);
+        }
+        if (stats) {
+            counts.resize(StatsColumns * ChunkRows * 8);
+        }
+        if (client) {
+            clientValues.resize(ClientColumns * ChunkRows * 8);
+        }
+        return bool(file);
+    }
+
+    /*
+     * Adds one sample. Samples past the capacity are dropped.
+     * min and mad are only stored with repeat > 1, and the StatsColumns
+     * operation counts only after setStats(true), the ClientColumns client
+     * values only after setClient(true).
+     */
+    void append(const num &message, const num &signature, int64_t duration, int64_t min = 0, int64_t mad = 0,
+                const uint64_t *operations = NULL, const int64_t *clients = NULL){
+        if (count >= capacity) {
+            return;
+        }
+        uint64_t row = count - flushed;
+        putNum(&messages[row * rowBytes], message);
+        putNum(&signatures[row * rowBytes], signature);
+        put64(&durations[row * 8], (uint64_t)duration);
+        if (header.repeat > 1) {
+            put64(&mins[row * 8], (uint64_t)min);
+            put64(&mads[row * 8], (uint64_t)mad);
+        }
+        if (stats) {
+            for (int i = 0; i < StatsColumns; i++) {
+                put64(&counts[(i * ChunkRows + row) * 8], operations ? operations[i] : 0);
+            }
+        }
+        if (client) {
+            for (int i = 0; i < ClientColumns; i++) {
+                put64(&clientValues[(i * ChunkRows + row) * 8], clients ? uint64_t(clients[i]) : 0);
+            }
+        }
+        count++;
+        if (count - flushed == ChunkRows) {
+            flush();
+        }
+    }
+
+    /*
+     * Writes the buffered samples and the final header, and closes the file.
+     */
+    bool close(){
+        if (!file.is_open()) {
+            return true;
+        }
+        flush();
+        // Extend the file to the end of the last column, so it can be mmapped whole.
+        const uint64_t end = columnsEnd();
+        if (capacity > 0 && count < capacity) {
+            file.seekp(end - 1);
+            file.put(0);
+        }
+        header.count = count;
+        std::vector<unsigned char> bytes = encodeHeader(header);
+        file.seekp(0);
+        file.write((const char*)&bytes[0], bytes.size());
+        bool ok = bool(file);
+        file.close();
+        return ok;
+    }
+
+private:
+    void flush(){
+        uint64_t rows = count - flushed;
+        if (rows == 0) {
+            return;
+        }
+        file.seekp(header.messageOffset + flushed * rowBytes);
+        file.write((const char*)&messages[0], rows * rowBytes);
+        file.seekp(header.signatureOffset + flushed * rowBytes);
+        file.write((const char*)&signatures[0], rows * rowBytes);
+        file.seekp(header.durationOffset + flushed * 8);
+        file.write((const char*)&durations[0], rows * 8);
+        if (header.repeat > 1) {
+            file.seekp(header.minOffset + flushed * 8);
+            file.write((const char*)&mins[0], rows * 8);
+            file.seekp(header.madOffset + flushed * 8);
+            file.write((const char*)&mads[0], rows * 8);
+        }
+        if (stats) {
+            for (int i = 0; i < StatsColumns; i++) {
+                file.seekp(statsColumnOffset(header, i) + flushed * 8);
+                file.write((const char*)&counts[i * ChunkRows * 8], rows * 8);
+            }
+        }
+        if (client) {
+            for (int i = 0; i < ClientColumns; i++) {
+                file.seekp(clientColumnOffset(header, i) + flushed * 8);
+                file.write((const char*)&clientValues[i * ChunkRows * 8], rows * 8);
+            }
+        }
+        flushed = count;
+    }
+
+    /*
+     * End of the last column laid out so far.
+     */
+    uint64_t columnsEnd() const {
+        if (header.clientOffset) {
+            return clientColumnOffset(header, ClientColumns - 1) + capacity * 8;
+        }
+        if (header.statsOffset) {
+            return statsColumnOffset(header, StatsColumns - 1) + capacity * 8;
+        }
+        return (header.madOffset ? header.madOffset : header.durationOffset) + capacity * 8;
+    }
+
+    std::ofstream file;
+    Header header;
+    const uint64_t rowBytes;
+    uint64_t count, flushed, capacity;
+    bool stats, client;
+    std::vector<unsigned char> messages, signatures, durations, mins, mads, counts, clientValues;
+};
+
+} // namespace dataset
+
+#endif /* defined(__rsa__dataset__) */
@@ -0,0 +1,194 @@
+//
+//  keygen.h
+//  rsa
+//
+//  RSA key generation: primes from sieved candidate windows, tested with
+//  Miller-Rabin on a thread pool.
+//
+
+#ifndef __rsa__keygen__
+#define __rsa__keygen__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "rsa.h"
+#include "random.h"
+#include "threadpool.h"
+
+/*
+ * Odd primes below SievePrimeLimit, grouped into products that fit in a
+ * word, so that a candidate is divided once per group instead of once per prime.
+ */
+const uint32_t SievePrimeLimit = 1 << 15;
+
+struct SieveGroup {
+    ttmath::uint product;
+    size_t first, count;    // primes[first, first + count)
+};
+
+struct SievePrimes {
+    std::vector<uint32_t> primes;
+    std::vector<SieveGroup> groups;
+
+    SievePrimes(){
+        std::vector<bool> composite(SievePrimeLimit, false);
+        for (uint32_t i = 3; i < SievePrimeLimit; i += 2) {
+            if (composite[i]) {
+                continue;
+            }
+            primes.push_back(i);
+            for (uint32_t j = i * i; j < SievePrimeLimit; j += 2 * i) {
+                composite[j] = true;
+            }
+        }
+        SieveGroup group = {1, 0, 0};
+        for (size_t i = 0; i < primes.size(); i++) {
+            if (group.product > ~ttmath::uint(0) / primes[i]) {
+                groups.push_back(group);
+                group.product = 1;
+                group.first = i;
+                group.count = 0;
+            }
+            group.product *= primes[i];
+            group.count++;
+        }
+        groups.push_back(group);
+    }
+
+    static const SievePrimes &get(){
+        static const SievePrimes instance;
+        return instance;
+    }
+};
+
+/*
+ * Miller-Rabin rounds for a random candidate of the given size, after
+ * FIPS 186-4 appendix C.3. Small candidates get many more, as they are cheap.
+ */
+inline int millerRabinRounds(long bits){
+    if (bits >= 1536) return 4;
+    if (bits >= 1024) return 5;
+    if (bits >= 512) return 7;
+    return 40;
+}
+
+/*
+ * Random prime of exactly bits bits with the top two bits set, so that the
+ * product of two of them has 2*bits bits, and with gcd(p-1, e) = 1.
+ *
+ * A random odd start x is sieved by the small primes over the window
+ * x, x+2, ..., x+2*(Window-1), and the survivors are tested with Miller-Rabin
+ * on the pool, worker w taking every size()-th survivor from the w-th on.
+ * The smallest survivor found prime so far is shared, and candidates above it
+ * are dropped, also between rounds, so the result only depends on rng and
+ * not on the number of threads. A window without a prime starts over.
+ * Zero for an even e, which no p-1 is coprime to, as p-1 is even as well.
+ */
+template<ttmath::uint Limbs, class Rng>
+ttmath::UInt<Limbs> randomPrime(long bits, const ttmath::UInt<Limbs> &e, ThreadPool &pool, Rng &rng){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    static const size_t Window = 4096;
+    const SievePrimes &sieve = SievePrimes::get();
+    const int rounds = millerRabinRounds(bits);
+
+    num top;
+    if (!e.IsTheLowestBitSet()) {
+        top.SetZero();
+        return top;
+    }
+    top.SetZero();
+    top.SetBit(bits);
+    for (;;) {
+        num x = bigrand(top, rng);
+        x.SetBit(bits - 1);
+        x.SetBit(bits - 2);
+        x.table[0] |= 1;
+        num last = x;
+        last.AddInt(2 * (Window - 1));
+        if (last >= top) {
+            continue;
+        }
+
+        // sieve x + 2j by every small prime
+        std::vector<bool> composite(Window, false);
+        for (const SieveGroup &group : sieve.groups) {
+            num quotient = x;
+            ttmath::uint rest;
+            quotient.DivInt(group.product, &rest);
+            for (size_t i = group.first; i < group.first + group.count; i++) {
+                const ttmath::uint prime = sieve.primes[i];
+                // first j with x + 2j = 0 (mod prime), 2 has the inverse (prime+1)/2
+                ttmath::uint r = rest % prime;
+                ttmath::uint j = (r == 0) ? 0 : ((prime - r) * ((prime + 1) / 2)) % prime;
+                for (; j < Window; j += prime) {
+                    composite[j] = true;
+                }
+            }
+        }
+        std::vector<ttmath::uint> survivors;
+        for (size_t j = 0; j < Window; j++) {
+            if (!composite[j]) {
+                survivors.push_back(ttmath::uint(2 * j));
+            }
+        }
+
+        const uint64_t roundSeed = rng();
+        std::atomic<size_t> best(survivors.size());
+        pool.parallelFor(size_t(pool.size()), [&](size_t, size_t, int worker){
+            for (size_t i = worker; i < survivors.size() && i < best; i += pool.size()) {
+                num candidate = x;
+                candidate.AddInt(survivors[i]);
+                num pm1 = candidate;
+                pm1.SubOne();
+                if (RsaN::ModInverse(e, pm1) == 0) {
+                    continue;   // e | p-1, no private exponent
+                }
+                const typename RsaN::Context ctx(candidate);
+                Xoshiro256 bases(roundSeed + i);
+                num range = candidate;
+                range.SubInt(3);
+                bool prime = RsaN::MillerRabin(2, ctx);
+                for (int k = 1; prime && k < rounds && i < best; k++) {
+                    num a = bigrand(range, bases);
+                    a.AddInt(2);    // in [2, n-2]
+                    prime = RsaN::MillerRabin(a, ctx);
+                }
+                if (prime && i < best) {
+                    size_t current = best;
+                    while (i < current && !best.compare_exchange_weak(current, i)) {
+                    }
+                    return;
+                }
+            }
+        });
+        if (best < survivors.size()) {
+            num prime = x;
+            prime.AddInt(survivors[best]);
+            return prime;
+        }
+    }
+}
+
+/*
+ * RSA key with a bits bit modulus and public exponent e, from two distinct
+ * bits/2 bit primes. The private exponent and the CRT values are computed
+ * by the Rsa constructor. False, and key untouched, when e is even.
+ */
+template<ttmath::uint Limbs, class Rng>
+bool generateKey(long bits, const ttmath::UInt<Limbs> &e, ThreadPool &pool, Rng &rng, Rsa<Limbs> &key){
+    ttmath::UInt<Limbs> p, q;
+    p = randomPrime<Limbs>(bits / 2, e, pool, rng);
+    if (p.IsZero()) {
+        return false;
+    }
+    do {
+        q = randomPrime<Limbs>(bits - bits / 2, e, pool, rng);
+    } while (q == p);
+    key = Rsa<Limbs>(p, q, e);
+    return true;
+}
+
+#endif /* defined(__rsa__keygen__) */
@@ -300,6 +300,22 @@ namespace ttmath
 #endif
 
 
+/*!
+	this is a limit when calculating Karatsuba squaring
+	if the size of a vector is smaller than TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE
+	the Karatsuba algorithm will use the schoolbook squaring
+	(the schoolbook squaring needs only half of the word multiplications,
+	so it stays faster up to bigger sizes than the schoolbook multiplication)
+*/
+#ifndef TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE
+	#ifdef TTMATH_DEBUG_LOG
+		#define TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE 3
+	#else
+		#define TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE 48
+	#endif
+#endif
+
+
 /*!
 	this is a special value used when calculating the Gamma(x) function
 	if x is greater than this value then the Gamma(x) will be calculated using
@@ -669,6 +685,30 @@ namespace ttmath
 
 
 
+	/*!
+		the Karatsuba limits used at run time
+
+		they start at TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE and
+		TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE, and can be set to the crossover
+		measured on the machine (before any thread multiplies, they are not atomic)
+	*/
+	inline uint & KaratsubaMultiplicationFromSize()
+	{
+	static uint size = TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE;
+
+	return size;
+	}
+
+
+	inline uint & KaratsubaSquaringFromSize()
+	{
+	static uint size = TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE;
+
+	return size;
+	}
+
+
+
 
 } // namespace
 
@@ -1180,7 +1180,8 @@ public:
 		multiplication: this = this * ss2
 
 		This is Karatsuba Multiplication algorithm, we're using it when value_size is greater than
-		or equal to TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE macro (defined in ttmathuint.h).
+		or equal to KaratsubaMultiplicationFromSize() (TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE
+		unless changed at run time, defined in ttmathtypes.h).
 		If value_size is smaller then we're using Mul2Big() instead.
 
 		Karatsuba multiplication:
@@ -1256,7 +1257,7 @@ private:
 	const uint * x1, * x0, * y1, * y0;
 
 
-		if( ss_size>1 && ss_size<TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE )
+		if( ss_size>1 && ss_size<KaratsubaMultiplicationFromSize() )
 		{
 			UInt<ss_size*2> res;
 			Mul2Big2<ss_size>(ss1, ss2, res);
@@ -1493,7 +1494,7 @@ public:
 	*/
 	void MulFastestBig(const UInt<value_size> & ss2, UInt<value_size*2> & result)
 	{
-		if( value_size < TTMATH_USE_KARATSUBA_MULTIPLICATION_FROM_SIZE )
+		if( value_size < KaratsubaMultiplicationFromSize() )
 			return Mul2Big(ss2, result);
 
 		uint x1size  = value_size, x2size  = value_size;
@@ -1528,6 +1529,356 @@ public:
 	}
 
 
+	/*!
+	 *
+	 * Squaring
+	 *
+	 *
+	*/
+
+public:
+
+
+	/*!
+		the squaring 'this' = 'this' * 'this'
+
+		it can return a carry
+		algorithm: 100 - means automatically choose the fastest algorithm
+	*/
+	uint Sqr(uint algorithm = 100)
+	{
+	UInt<value_size*2> result;
+	uint i, c = 0;
+
+		SqrBig(result, algorithm);
+
+		// copying result
+		for(i=0 ; i<value_size ; ++i)
+			table[i] = result.table[i];
+
+		// testing carry
+		for( ; i<value_size*2 ; ++i)
+			if( result.table[i] != 0 )
+			{
+				c = 1;
+				break;
+			}
+
+		TTMATH_LOGC("UInt::Sqr", c)
+
+	return c;
+	}
+
+
+	/*!
+		the squaring 'result' = 'this' * 'this'
+
+		since the 'result' is twice bigger than 'this'
+		this method never returns a carry
+
+		algorithm: 2   - schoolbook squaring (Sqr2Big)
+		           3   - Karatsuba squaring (Sqr3Big)
+		           100 - means automatically choose the fastest algorithm
+	*/
+	void SqrBig(UInt<value_size*2> & result, uint algorithm = 100) const
+	{
+		switch( algorithm )
+		{
+		case 2:
+			return Sqr2Big(result);
+
+		case 3:
+			return Sqr3Big(result);
+
+		case 100:
+		default:
+			return SqrFastestBig(result);
+		}
+	}
+
+
+	/*!
+		squaring: result = this * this
+
+		this is the schoolbook multiplication where each cross product x_i*x_j (i<j)
+		is calculated only once and then doubled, so it needs about half
+		of the word multiplications of Mul2Big()
+		result is twice bigger than this, this method never returns carry
+	*/
+	void Sqr2Big(UInt<value_size*2> & result) const
+	{
+		Sqr2Big2<value_size>(table, result.table);
+
+		TTMATH_LOG("UInt::Sqr2Big")
+	}
+
+
+	/*!
+		squaring: result = this * this
+
+		Karatsuba squaring, we're using it when value_size is greater than
+		or equal to KaratsubaSquaringFromSize() (TTMATH_USE_KARATSUBA_SQUARING_FROM_SIZE
+		unless changed at run time, defined in ttmathtypes.h)
+
+			x   = x1*B^m + x0
+			x^2 = z2*B^(2m) + z1*B^m + z0
+		where
+			z0 = x0^2
+			z2 = x1^2
+			z1 = (x1 + x0)^2 - z2 - z0
+
+		result is twice bigger than this, this method never returns carry
+	*/
+	void Sqr3Big(UInt<value_size*2> & result) const
+	{
+		Sqr3Big2<value_size>(table, result.table);
+
+		TTMATH_LOG("UInt::Sqr3Big")
+	}
+
+
+	/*!
+		squaring: result = this * this
+
+		this method is trying to select the fastest algorithm
+	*/
+	void SqrFastestBig(UInt<value_size*2> & result) const
+	{
+		if( value_size < KaratsubaSquaringFromSize() )
+			return Sqr2Big(result);
+
+		uint xsize;
+		for(xsize=value_size ; xsize>0 && table[xsize-1]==0 ; --xsize);
+
+		if( xsize < KaratsubaSquaringFromSize() || xsize <= value_size/2 )
+			// the Karatsuba algorithm splits the whole table in halves,
+			// when the high half is empty the schoolbook squaring is faster
+			return Sqr2Big(result);
+
+		Sqr3Big(result);
+
+		TTMATH_LOG("UInt::SqrFastestBig")
+	}
+
+
+private:
+
+
+	/*!
+		an auxiliary method for calculating the schoolbook squaring
+		result has ss_size*2 words
+	*/
+	template<uint ss_size>
+	void Sqr2Big2(const uint * ss, uint * result) const
+	{
+	uint xsize, i, j, r2, r1, c, lo, hi;
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wtautological-compare"
+#endif
+
+		for(i=0 ; i<ss_size*2 ; ++i)
+			result[i] = 0;
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+		for(xsize=ss_size ; xsize>0 && ss[xsize-1]==0 ; --xsize);
+
+		// the cross products x_i*x_j (i<j), one row at a time
+		// the carry of the row i goes to the word i+xsize which is not used yet
+		for(i=0 ; i+1<xsize ; ++i)
+		{
+			c = 0;
+
+			for(j=i+1 ; j<xsize ; ++j)
+			{
+				MulTwoWords(ss[i], ss[j], &r2, &r1);
+				r1 += c;
+				r2 += (r1 < c) ? 1 : 0;
+				result[i+j] += r1;
+				r2 += (result[i+j] < r1) ? 1 : 0;
+				c = r2;
+			}
+
+			result[i+xsize] = c;
+		}
+
+		// doubling the cross products
+		c = 0;
+		for(i=0 ; i<xsize*2 ; ++i)
+		{
+			r1 = result[i];
+			result[i] = (r1 << 1) | c;
+			c = r1 >> (TTMATH_BITS_PER_UINT - 1);
+		}
+
+		// adding the squares x_i*x_i
+		c = 0;
+		for(i=0 ; i<xsize ; ++i)
+		{
+			MulTwoWords(ss[i], ss[i], &r2, &r1);
+
+			lo = result[2*i] + c;
+			c  = (lo < c) ? 1 : 0;
+			lo += r1;
+			c += (lo < r1) ? 1 : 0;
+			result[2*i] = lo;
+
+			hi = result[2*i+1] + c;
+			c  = (hi < c) ? 1 : 0;
+			hi += r2;
+			c += (hi < r2) ? 1 : 0;
+			result[2*i+1] = hi;
+		}
+
+		TTMATH_ASSERT( c==0 )
+	}
+
+
+	/*!
+		an auxiliary method for calculating the Karatsuba squaring
+
+		result_size is equal ss_size*2
+	*/
+	template<uint ss_size>
+	void Sqr3Big2(const uint * ss, uint * result) const
+	{
+	const uint * x1, * x0;
+
+		if( ss_size>1 && ss_size<KaratsubaSquaringFromSize() )
+		{
+			Sqr2Big2<ss_size>(ss, result);
+		return;
+		}
+		else
+		if( ss_size == 1 )
+		{
+			return MulTwoWords(*ss, *ss, &result[1], &result[0]);
+		}
+
+
+		if( (ss_size & 1) == 1 )
+		{
+			// ss_size is odd
+			x0 = ss;
+			x1 = ss + ss_size / 2 + 1;
+
+			// the second vector (x1) is smaller about one from the first one (x0)
+			Sqr3Big3<ss_size/2 + 1, ss_size/2, ss_size*2>(x1, x0, result);
+		}
+		else
+		{
+			// ss_size is even
+			x0 = ss;
+			x1 = ss + ss_size / 2;
+
+			Sqr3Big3<ss_size/2, ss_size/2, ss_size*2>(x1, x0, result);
+		}
+	}
+
+
+#ifdef _MSC_VER
+#pragma warning (disable : 4717)
+//warning C4717: recursive on all control paths, function will cause runtime stack overflow
+//we have the stop point in Sqr3Big2() method
+#endif
+
+
+	/*!
+		an auxiliary method for calculating the Karatsuba squaring
+
+			x = x1*B^m + x0
+
+			first_size  - is the size of vector x0
+			second_size - is the size of vector x1 (can be either equal first_size or smaller about one from first_size)
+
+			x^2 = z2*B^(2m) + z1*B^m + z0
+		      where
+			   z0 = x0^2
+			   z2 = x1^2
+			   z1 = (x1 + x0)^2 - z2 - z0
+
+		this is Mul3Big3() with x equal to y
+	*/
+	template<uint first_size, uint second_size, uint result_size>
+	void Sqr3Big3(const uint * x1, const uint * x0, uint * result) const
+	{
+	uint i, xc;
+
+		UInt<first_size>   temp;
+		UInt<first_size*3> z1;
+
+		// z0 and z2 we store directly in the result
+		Sqr3Big2<first_size>(x0, result);                  // z0
+		Sqr3Big2<second_size>(x1, result+first_size*2);    // z2
+
+		// temp = (x0 + x1), the carry is remembered in xc
+		//
+		//   (xc*B^m + temp)^2 = temp^2 + 2*xc*temp*B^m + xc*B^(2m)
+		//
+		// and the result is never larger in size than 3*first_size
+
+		xc = AddVector(x0, x1, first_size, second_size, temp.table);
+
+		Sqr3Big2<first_size>(temp.table, z1.table);
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wtautological-compare"
+#endif
+
+		// clearing the rest of z1
+		for(i=first_size*2 ; i<first_size*3 ; ++i)
+			z1.table[i] = 0;
+
+		if( xc )
+		{
+			// 2*temp*B^m, the sum fits in z1 so there is no carry out
+			AddVector(z1.table+first_size, temp.table, first_size*3-first_size, first_size, z1.table+first_size);
+			AddVector(z1.table+first_size, temp.table, first_size*3-first_size, first_size, z1.table+first_size);
+
+			for( i=first_size*2 ; i<first_size*3 ; ++i )
+				if( ++z1.table[i] != 0 )
+ 					break;  // break if there was no carry 
+		}
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+		// z1 = z1 - z2
+		SubVector(z1.table, result+first_size*2, first_size*3, second_size*2, z1.table);
+
+		// z1 = z1 - z0
+		SubVector(z1.table, result, first_size*3, first_size*2, z1.table);
+
+		// now we're adding z1 to the result
+
+		if( first_size > second_size )
+		{
+			uint z1_size = result_size - first_size;
+			TTMATH_ASSERT( z1_size <= first_size*3 )
+
+			AddVector(result+first_size, z1.table, result_size-first_size, z1_size, result+first_size);
+		}
+		else
+		{
+			AddVector(result+first_size, z1.table, result_size-first_size, first_size*3, result+first_size);
+		}
+	}
+
+
+#ifdef _MSC_VER
+#pragma warning (default : 4717)
+#endif
+
+
+public:
+
+
 	/*!
 	 *
 	 * Division
@@ -4134,6 +4485,10 @@ public:
 	static sint FindLowestBitInWord(uint x);
 	static uint SetBitInWord(uint & value, uint bit);
 	static void MulTwoWords(uint a, uint b, uint * result_high, uint * result_low);
+	static uint MulAddVector(const uint * ss, uint m, uint size, uint * result);
+#if !defined(TTMATH_NOASM) && defined(TTMATH_PLATFORM64)
+	static bool HasMulx();
+#endif
 	static void DivTwoWords(uint a,uint b, uint c, uint * r, uint * rest);
 
 };
@@ -753,6 +753,34 @@ namespace ttmath
 
 
 
+	/*!
+		multiply-accumulate of a vector by one word:
+		result[0..size-1] += m * ss[0..size-1]
+
+		returns the word that is carried out of result[size-1]
+		(it is never bigger than m, it is not added anywhere)
+		this is one row of the schoolbook multiplication, used by the Montgomery products
+	*/
+	template<uint value_size>
+	uint UInt<value_size>::MulAddVector(const uint * ss, uint m, uint size, uint * result)
+	{
+	uint c = 0, r1, r2;
+
+		for(uint i=0 ; i<size ; ++i)
+		{
+			MulTwoWords(m, ss[i], &r2, &r1);
+			r1 += c;
+			r2 += (r1 < c) ? 1 : 0;
+			result[i] += r1;
+			r2 += (result[i] < r1) ? 1 : 0;
+			c = r2;
+		}
+
+	return c;
+	}
+
+
+
 
 	/*!
 	 *
@@ -1076,6 +1076,93 @@ namespace ttmath
 
 
 
+	/*!
+		true if the processor has mulx (BMI2) and adcx/adox (ADX)
+	*/
+	template<uint value_size>
+	bool UInt<value_size>::HasMulx()
+	{
+		#ifdef __GNUC__
+			static const bool has = __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx");
+			return has;
+		#else
+			return false;
+		#endif
+	}
+
+
+	/*!
+		multiply-accumulate of a vector by one word:
+		result[0..size-1] += m * ss[0..size-1]
+
+		returns the word that is carried out of result[size-1]
+		(it is never bigger than m, it is not added anywhere)
+		this is one row of the schoolbook multiplication, used by the Montgomery products
+
+		with BMI2 and ADX (checked by cpuid at run time) mulx leaves the flags alone, and
+		the carries of the products and of the sums go on two separate chains (adcx uses
+		the carry flag, adox the overflow flag), so consecutive words don't wait for each other,
+		otherwise this is the same loop as with TTMATH_NOASM, using the mul of MulTwoWords
+	*/
+	template<uint value_size>
+	uint UInt<value_size>::MulAddVector(const uint * ss, uint m, uint size, uint * result)
+	{
+	uint c = 0;
+
+		if( size == 0 )
+			return 0;
+
+		#ifdef __GNUC__
+		if( HasMulx() )
+		{
+		uint dummy1, dummy2, dummy3;
+
+			__asm__ __volatile__(
+
+				"lea (%%rsi,%%rcx,8), %%rsi			\n"   // rsi, rdi point after the vectors
+				"lea (%%rdi,%%rcx,8), %%rdi			\n"
+				"neg %%rcx							\n"   // and rcx counts from -size up to 0
+				"xor %%r8d, %%r8d					\n"   // r8 = 0 (the high word), cf = of = 0
+			"1:										\n"
+				"mulx (%%rsi,%%rcx,8), %%rax, %%r9	\n"   // r9:rax = m * ss[i]
+				"adcx %%r8, %%rax					\n"   // + high word of the previous product, cf chain
+				"adox (%%rdi,%%rcx,8), %%rax		\n"   // + result[i], of chain
+				"mov %%rax, (%%rdi,%%rcx,8)			\n"
+				"mov %%r9, %%r8						\n"
+				"lea 1(%%rcx), %%rcx				\n"   // lea and jrcxz leave both chains alone
+				"jrcxz 2f							\n"
+				"jmp 1b								\n"
+			"2:										\n"
+				"mov $0, %%eax						\n"
+				"adcx %%rax, %%r8					\n"
+				"adox %%rax, %%r8					\n"
+				"mov %%r8, %%rax					\n"
+
+				: "=a" (c), "=S" (dummy1), "=D" (dummy2), "=c" (dummy3)
+				: "d" (m), "1" (ss), "2" (result), "3" (size)
+				: "%r8", "%r9", "cc", "memory" );
+
+		return c;
+		}
+		#endif
+
+		uint r1, r2;
+
+		for(uint i=0 ; i<size ; ++i)
+		{
+			MulTwoWords(m, ss[i], &r2, &r1);
+			r1 += c;
+			r2 += (r1 < c) ? 1 : 0;
+			result[i] += r1;
+			r2 += (result[i] < r1) ? 1 : 0;
+			c = r2;
+		}
+
+	return c;
+	}
+
+
+
 
 	/*!
 	 *
@@ -0,0 +1,80 @@
+//
+//  protocol.h
+//  rsa
+//
+//  Datagrams of the UDP signing server (csv --serve).
+//
+
+#ifndef __rsa__protocol__
+#define __rsa__protocol__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dataset.h"
+
+/*
+ * Every datagram starts with a 64 bit request id, which the response
+ * repeats, so a client with many requests in flight can match them up.
+ * Numbers are words 64 bit words, little endian, as in dataset.h.
+ *
+ *   key request        id
+ *   key response       id, uint32 words, uint32 keyBits, N, E
+ *   sign request       id, message
+ *   sign response      id, signature, int64 server side duration in ns
+ *   stop request       id, uint64 StopMagic
+ *   stop response      id, uint64 StopMagic
+ *
+ * A sign request for a message that is not below N gets no response.
+ * A stop request makes the server write its log and exit, see csv --serve.
+ */
+namespace protocol {
+
+const uint16_t DefaultPort = 7458;
+const size_t IdBytes = 8;
+const uint64_t StopMagic = 0x504f545341535200ULL;  // "\0RSASTOP" little endian
+const size_t StopRequestBytes = IdBytes + 8;
+
+inline size_t keyResponseBytes(uint32_t words){
+    return IdBytes + 8 + 16 * size_t(words);
+}
+
+inline size_t signRequestBytes(uint32_t words){
+    return IdBytes + 8 * size_t(words);
+}
+
+inline size_t signResponseBytes(uint32_t words){
+    return IdBytes + 8 * size_t(words) + 8;
+}
+
+template<ttmath::uint Limbs>
+size_t encodeKeyResponse(unsigned char *p, uint64_t id, const ttmath::UInt<Limbs> &n, const ttmath::UInt<Limbs> &e,
+                         uint32_t keyBits){
+    const uint32_t words = dataset::wordsFor<Limbs>();
+    dataset::put64(p, id);
+    dataset::put32(p + IdBytes, words);
+    dataset::put32(p + IdBytes + 4, keyBits);
+    dataset::putNum(p + IdBytes + 8, n);
+    dataset::putNum(p + IdBytes + 8 + 8 * words, e);
+    return keyResponseBytes(words);
+}
+
+template<ttmath::uint Limbs>
+size_t encodeSignResponse(unsigned char *p, uint64_t id, const ttmath::UInt<Limbs> &signature, int64_t duration){
+    const uint32_t words = dataset::wordsFor<Limbs>();
+    dataset::put64(p, id);
+    dataset::putNum(p + IdBytes, signature);
+    dataset::put64(p + IdBytes + 8 * words, (uint64_t)duration);
+    return signResponseBytes(words);
+}
+
+template<ttmath::uint Limbs>
+size_t encodeSignRequest(unsigned char *p, uint64_t id, const ttmath::UInt<Limbs> &message){
+    dataset::put64(p, id);
+    dataset::putNum(p + IdBytes, message);
+    return signRequestBytes(dataset::wordsFor<Limbs>());
+}
+
+} // namespace protocol
+
+#endif /* defined(__rsa__protocol__) */
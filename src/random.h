@@ -0,0 +1,120 @@
+//
+//  random.h
+//  rsa
+//
+//  Random numbers for the signing threads.
+//
+
+#ifndef __rsa__random__
+#define __rsa__random__
+
+#include <stdint.h>
+
+#include "lib/ttmath.h"
+
+/*
+ * xoshiro256** by Blackman and Vigna, seeded through splitmix64.
+ * Fast, 64 full bits per call, and jump() moves 2^128 steps ahead, which
+ * gives every signing thread its own stream that can not overlap the others.
+ * Meets UniformRandomBitGenerator, so it works with <random> distributions.
+ */
+class Xoshiro256 {
+public:
+    typedef uint64_t result_type;
+
+    explicit Xoshiro256(uint64_t seed = 0){
+        for (auto &word : s) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min(){ return 0; }
+    static constexpr result_type max(){ return ~uint64_t(0); }
+
+    inline uint64_t operator()(){
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    /*
+     * Advances the state by 2^128 calls.
+     */
+    void jump(){
+        static const uint64_t poly[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        advance(poly);
+    }
+
+    /*
+     * Advances the state by 2^192 calls, for a second family of streams.
+     */
+    void longJump(){
+        static const uint64_t poly[] = {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+                                        0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+        advance(poly);
+    }
+
+private:
+    uint64_t s[4];
+
+    static inline uint64_t rotl(uint64_t x, int k){
+        return (x << k) | (x >> (64 - k));
+    }
+
+    void advance(const uint64_t poly[4]){
+        uint64_t t[4] = {0, 0, 0, 0};
+        for (int i = 0; i < 4; i++) {
+            for (int b = 0; b < 64; b++) {
+                if (poly[i] & (uint64_t(1) << b)) {
+                    for (int j = 0; j < 4; j++) t[j] ^= s[j];
+                }
+                (*this)();
+            }
+        }
+        for (int j = 0; j < 4; j++) s[j] = t[j];
+    }
+};
+
+/*
+ * Uniform random number in [0, max), or any UInt<Limbs> if max is 0.
+ *
+ * Fills the limbs that max uses with full words from rng, masks the top one
+ * to the bit length of max, and draws again while the result is >= max.
+ * That takes less than two draws on average, and needs no division.
+ */
+template<ttmath::uint Limbs, class Rng>
+ttmath::UInt<Limbs> bigrand(const ttmath::UInt<Limbs> &max, Rng &rng){
+    ttmath::UInt<Limbs> result;
+    result.SetZero();
+    if (max.IsZero()) {
+        for (auto &el : result.table) {
+            el = ttmath::uint(rng());
+        }
+        return result;
+    }
+    ttmath::uint top;
+    ttmath::uint bit;
+    max.FindLeadingBit(top, bit);   // the highest set bit of max is bit `bit` of limb `top`
+    const ttmath::uint mask = (bit + 1 == TTMATH_BITS_PER_UINT) ? ~ttmath::uint(0)
+                                                                : ((ttmath::uint(1) << (bit + 1)) - 1);
+    do {
+        for (ttmath::uint i = 0; i < top; i++) {
+            result.table[i] = ttmath::uint(rng());
+        }
+        result.table[top] = ttmath::uint(rng()) & mask;
+    } while (result >= max);
+    return result;
+}
+
+#endif /* defined(__rsa__random__) */
@@ -4,26 +4,103 @@
 //  Created by Arve Nygård on 05/05/15.
 //  Copyright (c) 2015 Arve Nygård. All rights reserved.
 //
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 #include "rsa.h"
 using namespace std;
 
+#ifdef RSA_STATS
+/*
+ * Cheap counter read for RsaStats, without the serialization Timer uses.
+ */
+static inline uint64_t statsTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t(hi) << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return 0;
+#endif
+}
+#define RSA_STATS_BEGIN() const uint64_t statsStart = statsTicks()
+#define RSA_STATS_END(square, subtraction) RsaStats::current().record(square, subtraction, statsTicks() - statsStart)
+#else
+#define RSA_STATS_BEGIN()
+#define RSA_STATS_END(square, subtraction)
+#endif
+
+/*
+ * Precomputes mu = floor(4^k / n) for the modulus n.
+ * 4^k needs 2k+1 bits, one more than a numWide has when k is the full width.
+ */
+template<ttmath::uint Limbs>
+BarrettContext<Limbs>::BarrettContext(const num &n):n(n){
+    ttmath::UInt<2*Limbs+2> power, divisor;
+    k = Rsa<Limbs>::numBits(n);
+    power.SetZero();
+    power.SetBit(2*k);
+    divisor.FromUInt(n);
+    power /= divisor;
+    mu.FromUInt(power);
+}
+
+/*
+ * Precomputes r, r mod n, r^2 mod n and n0 for the modulus n,
+ * and the Barrett values for the same modulus.
+ */
+template<ttmath::uint Limbs>
+MontgomeryContext<Limbs>::MontgomeryContext(const num &n):n(n),barrett(n){
+    k = Rsa<Limbs>::numBits(n);
+    r.SetZero();
+    r.SetBit(k);
+    n0 = Rsa<Limbs>::NegInverseWord(n.table[0]);
+    rModN = Rsa<Limbs>::Reduce(r, n);
+    r2ModN = Rsa<Limbs>::MulModBarrett(rModN, rModN, barrett);
+}
+
 /*
  * Sets which exponentiation method is to be used.
  *
- * Choose between MODEXP, MODEXP_SLEEP, and POWERLADDER.
+ * Choose between MODEXP, MODEXP_SLEEP, POWERLADDER, BARRETT_LADDER, MODEXP_CRT,
+ * SLIDING_WINDOW, FIXED_WINDOW and MONTGOMERY_LADDER.
  * Default is MODEXP.
+ * MODEXP_CRT only changes decryption, encryption uses MODEXP.
  */
-void Rsa::setExpFunc(const ExpType expType){
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::setExpFunc(const ExpType expType){
+    crt = (expType == MODEXP_CRT);
     switch (expType) {
         case POWERLADDER:
             ef = &Rsa::PoweringLadder;
             break;
+        case BARRETT_LADDER:
+            ef = &Rsa::PoweringLadderBarrett;
+            break;
         case MODEXP:
             ef = &Rsa::ModExp;
             break;
         case MODEXP_SLEEP:
             ef = &Rsa::ModExpSleep;
             break;
+        case MODEXP_CRT:
+            ef = &Rsa::ModExp;
+            break;
+        case SLIDING_WINDOW:
+            ef = &Rsa::SlidingWindow;
+            break;
+        case FIXED_WINDOW:
+            ef = &Rsa::FixedWindow;
+            break;
+        case MONTGOMERY_LADDER:
+            ef = &Rsa::MontgomeryLadder;
+            break;
         default:
             ef = &Rsa::ModExp;
             break;
@@ -36,24 +113,56 @@ void Rsa::setExpFunc(const ExpType expType){
  * Default algorithm.
  * Suceptible to timing attacks.
  */
-num Rsa::ModExp(const num &M, const num &d, const num &n){
-    if (n%2 != 1) {
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModExp(const num &M, const num &d, const Context &ctx){
+    if (ctx.n%2 != 1) {
         cout << "Warning! Exponentiation failed. Modulus must be odd!";
         return 0;
     }
-    num r, nprime;
-    nPrime(n, r, nprime);
-    num M_bar = (M * r) % n;
-    num x_bar = r%n;
+    num M_bar = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    num x_bar = ctx.rModN;
 
     long k = numBits(d) - 1; // Loop over bit indices. [0, k-1]
     for (; k >= 0 ; k--) {
-        x_bar = MontgomeryProduct(x_bar, x_bar, nprime, r, n);
+        x_bar = MontgomeryProduct(x_bar, x_bar, ctx);
         if (d.GetBit(k)){
-            x_bar = MontgomeryProduct(M_bar, x_bar, nprime, r, n);
+            x_bar = MontgomeryProduct(M_bar, x_bar, ctx);
+        }
+    }
+    return MontgomeryProduct(x_bar, 1, ctx);
+}
+
+/*
+ * M raised to a public exponent e that fits in a word (mod n), for
+ * encryption and verification.
+ *
+ * The square and multiply chain of ModExp, but x starts at M_bar instead of
+ * squaring 1 first, and the multiplication for the last bit (e is odd) is by
+ * M itself instead of M_bar, which also takes the result out of the
+ * Montgomery domain. e = 2^k+1 (3, 17, 65537) costs k+2 products in all.
+ * Not constant time, e is public.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModExpPublic(const num &M, ttmath::uint e, const Context &ctx){
+    if (e == 1) {
+        return M;
+    }
+    if (!(e & 1)) {
+        return ModExp(M, e, ctx);
+    }
+    num M_bar = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    num x_bar = M_bar;
+
+    long k = TTMATH_BITS_PER_UINT - 1;
+    while (!((e >> k) & 1)) k--;
+    for (k--; k > 0; k--) {
+        x_bar = MontgomeryProduct(x_bar, x_bar, ctx);
+        if ((e >> k) & 1) {
+            x_bar = MontgomeryProduct(x_bar, M_bar, ctx);
         }
     }
-    return MontgomeryProduct(x_bar, 1, nprime, r, n);
+    x_bar = MontgomeryProduct(x_bar, x_bar, ctx);
+    return MontgomeryProduct(x_bar, M, ctx);
 }
 
 /*
@@ -63,58 +172,838 @@ num Rsa::ModExp(const num &M, const num &d, const num &n){
  * Used to simulate a slow device.
  * Uses MontgomeryProductSleep.
  */
-num Rsa::ModExpSleep(const num &M, const num &d, const num &n){
-    if (n%2 != 1) {
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModExpSleep(const num &M, const num &d, const Context &ctx){
+    if (ctx.n%2 != 1) {
         cout << "Warning! Exponentiation failed. Modulus must be odd!";
         return 0;
     }
-    num r, nprime;
-    nPrime(n, r, nprime);
-    num M_bar = (M * r) % n;
-    num x_bar = r%n;
+    num M_bar = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    num x_bar = ctx.rModN;
 
     long k = numBits(d) - 1; // Loop over bit indices. [0, k-1]
     for (; k >= 0 ; k--) {
-        x_bar = MontgomeryProductSleep(x_bar, x_bar, nprime, r, n);
+        x_bar = MontgomeryProductSleep(x_bar, x_bar, ctx);
         if (d.GetBit(k) == 1){
-            x_bar = MontgomeryProductSleep(M_bar, x_bar, nprime, r, n);
+            x_bar = MontgomeryProductSleep(M_bar, x_bar, ctx);
+        }
+    }
+    return MontgomeryProductSleep(x_bar, 1, ctx);
+}
+
+/*
+ * Binary exponentiation of M raised to the power of d (mod n).
+ *
+ * The same products as ModExpSleep, but instead of sleeping it counts
+ * the step 4 subtractions that ModExpSleep would sleep for.
+ * Used to simulate a slow device without waiting for it.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModExpCount(const num &M, const num &d, const Context &ctx, long &subtractions){
+    subtractions = 0;
+    if (ctx.n%2 != 1) {
+        cout << "Warning! Exponentiation failed. Modulus must be odd!";
+        return 0;
+    }
+    num M_bar = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    num x_bar = ctx.rModN, u;
+
+    long k = numBits(d) - 1; // Loop over bit indices. [0, k-1]
+    for (; k >= 0 ; k--) {
+        subtractions += MontgomeryKernel(x_bar, x_bar, ctx, u);
+        x_bar = u;
+        if (d.GetBit(k) == 1){
+            subtractions += MontgomeryKernel(M_bar, x_bar, ctx, u);
+            x_bar = u;
+        }
+    }
+    subtractions += MontgomeryKernel(x_bar, 1, ctx, u);
+    return u;
+}
+
+/*
+ * Starts a step wise ModExp of M, before the first bit of the exponent.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ModExpBegin(const num &M, const Context &ctx, State &state){
+    state.M_bar = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    state.x_bar = ctx.rModN;
+}
+
+/*
+ * Computes the square and the product for the next bit, without advancing.
+ * Returns whether the product needs the step 4 subtraction,
+ * i.e. whether ModExp would subtract if the next bit is 1.
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::ModExpTry(State &state, const Context &ctx){
+    MontgomeryKernel(state.x_bar, state.x_bar, ctx, state.square);
+    return MontgomeryKernel(state.M_bar, state.square, ctx, state.product);
+}
+
+/*
+ * Advances past the next bit, with the values from the last ModExpTry.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ModExpCommit(State &state, bool bit){
+    state.x_bar = bit ? state.product : state.square;
+}
+
+/*
+ * Advances past the next bit. Returns whether its multiplication needed the
+ * step 4 subtraction (false for a 0 bit, which has none).
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::ModExpStep(State &state, bool bit, const Context &ctx){
+    MontgomeryKernel(state.x_bar, state.x_bar, ctx, state.square);
+    if (!bit) {
+        state.x_bar = state.square;
+        return false;
+    }
+    bool subtraction = MontgomeryKernel(state.M_bar, state.square, ctx, state.product);
+    state.x_bar = state.product;
+    return subtraction;
+}
+
+/*
+ * Result of the exponentiation by the bits so far, converted out of Montgomery form.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModExpEnd(const State &state, const Context &ctx){
+    return MontgomeryProduct(state.x_bar, 1, ctx);
+}
+
+/*
+ * Batch Montgomery products, for BatchLanes numbers with the same modulus.
+ *
+ * The numbers are held in radix 2^52 so that a digit product fits the 52 bit
+ * multiply-add of AVX-512 IFMA (vpmadd52luq/vpmadd52huq), and limb sliced so
+ * that one instruction works on the same digit of all eight lanes.
+ * Without IFMA the same steps run one lane at a time.
+ */
+static const uint64_t Digit = (uint64_t(1) << 52) - 1;
+
+/*
+ * Splits the low count*52 bits of x into 52 bit digits, digits[j*stride].
+ */
+template<ttmath::uint Limbs>
+static void SplitDigits(const ttmath::UInt<Limbs> &x, uint64_t *digits, int count, int stride){
+    const long w = TTMATH_BITS_PER_UINT;
+    for (int j = 0; j < count; j++) {
+        uint64_t v = 0;
+        long got = 0, pos = 52L * j;
+        while (got < 52 && pos / w < long(Limbs)) {
+            const long off = pos % w, take = std::min(w - off, 52 - got);
+            v |= (uint64_t(x.table[pos / w] >> off) & ((uint64_t(1) << take) - 1)) << got;
+            got += take;
+            pos += take;
         }
+        digits[j * stride] = v;
     }
-    return MontgomeryProductSleep(x_bar, 1, nprime, r, n);
+}
+
+/*
+ * The inverse of SplitDigits, for digits that fit in x.
+ */
+template<ttmath::uint Limbs>
+static void JoinDigits(const uint64_t *digits, int count, int stride, ttmath::UInt<Limbs> &x){
+    const long w = TTMATH_BITS_PER_UINT;
+    x.SetZero();
+    for (int j = 0; j < count; j++) {
+        const uint64_t v = digits[j * stride];
+        long put = 0, pos = 52L * j;
+        while (put < 52 && pos / w < long(Limbs)) {
+            const long off = pos % w, take = std::min(w - off, 52 - put);
+            x.table[pos / w] |= ttmath::uint((v >> put) & ((uint64_t(1) << take) - 1)) << off;
+            put += take;
+            pos += take;
+        }
+    }
+}
+
+/*
+ * Converts the MontgomeryContext values to 52 bit digits.
+ * n0 is -n^{-1} mod 2^52, the low 52 bits of ctx.n0.
+ */
+template<ttmath::uint Limbs>
+BatchContext<Limbs>::BatchContext(const MontgomeryContext<Limbs> &ctx){
+    digits = int((ctx.k + 51) / 52);
+    lastBits = int(ctx.k - 52L * (digits - 1));
+    n0 = ctx.n0 & Digit;
+    SplitDigits(ctx.n, n, Batch::Digits, 1);
+    for (int l = 0; l < Batch::Lanes; l++) {
+        SplitDigits(ctx.rModN, &rModN.d[0][l], Batch::Digits, Batch::Lanes);
+        SplitDigits(ctx.r2ModN, &r2ModN.d[0][l], Batch::Digits, Batch::Lanes);
+        SplitDigits(ttmath::UInt<Limbs>(1), &one.d[0][l], Batch::Digits, Batch::Lanes);
+    }
+}
+
+/*
+ * SOS Montgomery product of every lane, one lane at a time.
+ *
+ * t holds 2*digits+1 wide digits per lane. Digit products are added without
+ * carrying, the carries are only moved up when a digit has been reduced and
+ * once at the end; a 64 bit word has room for thousands of 52 bit terms.
+ * Like MontgomeryCIOS, the last step only clears lastBits bits, so the
+ * result and the step 4 subtraction are the same as MontgomeryKernel's.
+ * Returns a mask with bit l set if lane l needed the subtraction.
+ */
+static unsigned MontgomeryBatchPortable(const uint64_t *a, const uint64_t *b, const uint64_t *n, uint64_t n0,
+                                        int digits, int lastBits, uint64_t *u, uint64_t *t){
+    const int L = BatchNum<1>::Lanes, D = digits, b52 = 52 - lastBits;
+    unsigned mask = 0;
+    for (int l = 0; l < L; l++) {
+        for (int j = 0; j <= 2*D; j++) {
+            t[j] = 0;
+        }
+        ttmath::uint hi, lo;
+        for (int i = 0; i < D; i++) {
+            for (int j = 0; j < D; j++) {
+                ttmath::UInt<1>::MulTwoWords(a[i*L + l], b[j*L + l], &hi, &lo);
+                t[i+j] += lo & Digit;
+                t[i+j+1] += (uint64_t(hi) << 12) | (uint64_t(lo) >> 52);
+            }
+        }
+        for (int i = 0; i < D; i++) {
+            if (i > 0) {
+                t[i] += t[i-1] >> 52;
+            }
+            uint64_t m = (t[i] * n0) & Digit;
+            if (i == D - 1) {
+                m &= Digit >> b52;
+            }
+            for (int j = 0; j < D; j++) {
+                ttmath::UInt<1>::MulTwoWords(m, n[j], &hi, &lo);
+                t[i+j] += lo & Digit;
+                t[i+j+1] += (uint64_t(hi) << 12) | (uint64_t(lo) >> 52);
+            }
+        }
+        for (int j = D - 1; j < 2*D; j++) {
+            t[j+1] += t[j] >> 52;
+            t[j] &= Digit;
+        }
+
+        // u = t / 2^k, and u - n in the digits of t already read
+        uint64_t borrow = 0;
+        for (int j = 0; j <= D; j++) {
+            u[j*L + l] = (t[D-1+j] >> lastBits) | ((t[D+j] << b52) & Digit);
+            const uint64_t x = u[j*L + l] - (j < D ? n[j] : 0) - borrow;
+            borrow = x >> 63;
+            t[j] = x & Digit;
+        }
+        if (!borrow) {
+            mask |= 1u << l;
+            for (int j = 0; j < D; j++) {
+                u[j*L + l] = t[j];
+            }
+        }
+        u[D*L + l] = 0;
+    }
+    return mask;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// GCC 12 warns about the _mm512_undefined operand inside the shift intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+/*
+ * MontgomeryBatchPortable on all lanes at once, with AVX-512 IFMA.
+ * t holds 2*digits+1 vectors.
+ */
+__attribute__((target("avx512f,avx512ifma")))
+static unsigned MontgomeryBatchIfma(const uint64_t *a, const uint64_t *b, const uint64_t *n, uint64_t n0,
+                                    int digits, int lastBits, uint64_t *u, __m512i *t){
+    const int L = BatchNum<1>::Lanes, D = digits;
+    const __m512i zero = _mm512_setzero_si512(), digit = _mm512_set1_epi64(Digit), vn0 = _mm512_set1_epi64(n0);
+    const __m512i low = _mm512_set1_epi64(lastBits), high = _mm512_set1_epi64(52 - lastBits);
+    for (int j = 0; j <= 2*D; j++) {
+        t[j] = zero;
+    }
+    for (int i = 0; i < D; i++) {
+        const __m512i ai = _mm512_loadu_si512(a + i*L);
+        for (int j = 0; j < D; j++) {
+            const __m512i bj = _mm512_loadu_si512(b + j*L);
+            t[i+j] = _mm512_madd52lo_epu64(t[i+j], ai, bj);
+            t[i+j+1] = _mm512_madd52hi_epu64(t[i+j+1], ai, bj);
+        }
+    }
+    for (int i = 0; i < D; i++) {
+        if (i > 0) {
+            t[i] = _mm512_add_epi64(t[i], _mm512_srli_epi64(t[i-1], 52));
+        }
+        __m512i m = _mm512_madd52lo_epu64(zero, t[i], vn0);
+        if (i == D - 1) {
+            m = _mm512_and_si512(m, _mm512_srlv_epi64(digit, high));
+        }
+        for (int j = 0; j < D; j++) {
+            const __m512i nj = _mm512_set1_epi64(n[j]);
+            t[i+j] = _mm512_madd52lo_epu64(t[i+j], m, nj);
+            t[i+j+1] = _mm512_madd52hi_epu64(t[i+j+1], m, nj);
+        }
+    }
+    for (int j = D - 1; j < 2*D; j++) {
+        t[j+1] = _mm512_add_epi64(t[j+1], _mm512_srli_epi64(t[j], 52));
+        t[j] = _mm512_and_si512(t[j], digit);
+    }
+
+    // u = t / 2^k, and u - n in the digits of t already read. The lanes
+    // without a final borrow take the difference.
+    __m512i borrow = zero;
+    for (int j = 0; j <= D; j++) {
+        const __m512i uj = _mm512_or_si512(_mm512_srlv_epi64(t[D-1+j], low),
+                                           _mm512_and_si512(_mm512_sllv_epi64(t[D+j], high), digit));
+        const __m512i x = _mm512_sub_epi64(_mm512_sub_epi64(uj, j < D ? _mm512_set1_epi64(n[j]) : zero), borrow);
+        borrow = _mm512_srli_epi64(x, 63);
+        _mm512_storeu_si512(u + j*L, uj);
+        t[j] = _mm512_and_si512(x, digit);
+    }
+    const __mmask8 subtract = _mm512_cmpeq_epi64_mask(borrow, zero);
+    for (int j = 0; j < D; j++) {
+        _mm512_storeu_si512(u + j*L, _mm512_mask_blend_epi64(subtract, _mm512_loadu_si512(u + j*L), t[j]));
+    }
+    _mm512_storeu_si512(u + D*L, zero);
+    return subtract;
+}
+#pragma GCC diagnostic pop
+#endif
+
+/*
+ * True if MontgomeryBatch runs on AVX-512 IFMA, false if it emulates it.
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::BatchAvailable(){
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const bool ifma = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+    return ifma;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Sets lane of x to value, which must be < n.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::BatchLoad(Batch &x, int lane, const num &value){
+    SplitDigits(value, &x.d[0][lane], Batch::Digits, Batch::Lanes);
+}
+
+/*
+ * The number in lane of x.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::BatchStore(const Batch &x, int lane){
+    num value;
+    JoinDigits(&x.d[0][lane], Batch::Digits, Batch::Lanes, value);
+    return value;
+}
+
+/*
+ * MontgomeryKernel on every lane: u = a*b*r^{-1} mod n.
+ * Returns a mask with bit l set if lane l needed the step 4 subtraction.
+ * u may be a or b: every lane of a and b is read before that lane of u is written.
+ */
+template<ttmath::uint Limbs>
+unsigned Rsa<Limbs>::MontgomeryBatch(const Batch &a, const Batch &b, const BatchCtx &ctx, Batch &u){
+    unsigned mask;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (BatchAvailable()) {
+        __m512i t[2 * Batch::Digits + 1];
+        mask = MontgomeryBatchIfma(&a.d[0][0], &b.d[0][0], ctx.n, ctx.n0, ctx.digits, ctx.lastBits, &u.d[0][0], t);
+    }
+    else
+#endif
+    {
+        uint64_t t[2 * Batch::Digits + 1];
+        mask = MontgomeryBatchPortable(&a.d[0][0], &b.d[0][0], ctx.n, ctx.n0, ctx.digits, ctx.lastBits, &u.d[0][0], t);
+    }
+    // the kernels write digits+1 digits, the rest of u is 0 like the rest of a num
+    memset(u.d[ctx.digits + 1], 0, sizeof(u.d[0]) * (Batch::Digits - ctx.digits - 1));
+    return mask;
+}
+
+/*
+ * ModExpCount of up to BatchLanes messages with the same exponent.
+ * Lanes past the given ones are computed on 0 and dropped.
+ * subtractions, if given, gets the step 4 subtractions of every message.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ModExpBatch(const num *M, int lanes, const num &d, const BatchCtx &ctx, num *result, long *subtractions){
+    BatchState state;
+    ModExpBatchBegin(M, lanes, ctx, state);
+    long counts[Batch::Lanes] = {0};
+    unsigned mask;
+
+    long k = numBits(d) - 1; // Loop over bit indices. [0, k-1]
+    for (; k >= 0 ; k--) {
+        mask = MontgomeryBatch(state.x_bar, state.x_bar, ctx, state.x_bar);
+        for (int l = 0; l < lanes; l++) counts[l] += (mask >> l) & 1;
+        if (d.GetBit(k) == 1){
+            mask = MontgomeryBatch(state.M_bar, state.x_bar, ctx, state.x_bar);
+            for (int l = 0; l < lanes; l++) counts[l] += (mask >> l) & 1;
+        }
+    }
+    mask = MontgomeryBatch(state.x_bar, ctx.one, ctx, state.x_bar);
+    for (int l = 0; l < lanes; l++) {
+        result[l] = BatchStore(state.x_bar, l);
+        if (subtractions) {
+            subtractions[l] = counts[l] + ((mask >> l) & 1);
+        }
+    }
+}
+
+/*
+ * ModExpBegin for up to BatchLanes messages.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ModExpBatchBegin(const num *M, int lanes, const BatchCtx &ctx, BatchState &state){
+    memset(&state.M_bar, 0, sizeof(state.M_bar));
+    for (int l = 0; l < lanes; l++) {
+        BatchLoad(state.M_bar, l, M[l]);
+    }
+    MontgomeryBatch(state.M_bar, ctx.r2ModN, ctx, state.M_bar);
+    state.x_bar = ctx.rModN;
+}
+
+/*
+ * ModExpTry on every lane. Returns the lanes whose product needs the step 4 subtraction.
+ */
+template<ttmath::uint Limbs>
+unsigned Rsa<Limbs>::ModExpBatchTry(BatchState &state, const BatchCtx &ctx){
+    MontgomeryBatch(state.x_bar, state.x_bar, ctx, state.square);
+    return MontgomeryBatch(state.M_bar, state.square, ctx, state.product);
+}
+
+/*
+ * ModExpCommit on every lane.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ModExpBatchCommit(BatchState &state, bool bit){
+    state.x_bar = bit ? state.product : state.square;
+}
+
+/*
+ * ModExpStep on every lane. Returns the lanes whose multiplication needed
+ * the step 4 subtraction (none for a 0 bit).
+ */
+template<ttmath::uint Limbs>
+unsigned Rsa<Limbs>::ModExpBatchStep(BatchState &state, bool bit, const BatchCtx &ctx){
+    MontgomeryBatch(state.x_bar, state.x_bar, ctx, state.square);
+    if (!bit) {
+        state.x_bar = state.square;
+        return 0;
+    }
+    unsigned mask = MontgomeryBatch(state.M_bar, state.square, ctx, state.product);
+    state.x_bar = state.product;
+    return mask;
 }
 
 /*
  * Binary exponentiation of M raised to the power of d (mod n),
  * Using Montgomery Powering ladder
  */
-num Rsa::PoweringLadder(const num &message, const num &exponent, const num &modulus){
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::PoweringLadder(const num &message, const num &exponent, const Context &ctx){
+    const num &modulus = ctx.n;
     num R0 = 1, R1 = message;
-    long t = Rsa::numBits(exponent);
+    long t = numBits(exponent);
 
     for (long i = t-1; i>=0; i--) {
         if(!exponent.GetBit(i)){
             // The bit is 0
-            R1 = (R0*R1) % modulus;
-            R0 = (R0*R0) % modulus;
+            R1 = MulMod(R0, R1, modulus);
+            R0 = MulMod(R0, R0, modulus);
         }
         else {
             // The bit is 1
-            R0 = (R0*R1) % modulus;
-            R1 = (R1*R1) % modulus;
+            R0 = MulMod(R0, R1, modulus);
+            R1 = MulMod(R1, R1, modulus);
         }
     }
     return R0;
 }
 
+/*
+ * The same ladder as PoweringLadder, with every product reduced by
+ * Barrett reduction instead of a division.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::PoweringLadderBarrett(const num &message, const num &exponent, const Context &ctx){
+    const Barrett &barrett = ctx.barrett;
+    num R0 = 1, R1 = message;
+    long t = numBits(exponent);
+
+    for (long i = t-1; i>=0; i--) {
+        if(!exponent.GetBit(i)){
+            // The bit is 0
+            R1 = MulModBarrett(R0, R1, barrett);
+            R0 = MulModBarrett(R0, R0, barrett);
+        }
+        else {
+            // The bit is 1
+            R0 = MulModBarrett(R0, R1, barrett);
+            R1 = MulModBarrett(R1, R1, barrett);
+        }
+    }
+    return R0;
+}
+
+/*
+ * Step 4 of the Montgomery product: t (s+1 limbs, t < 2n) becomes t - n if t >= n.
+ *
+ * The default version only subtracts when needed, which is the timing leak the attack uses.
+ * With constantTime the subtraction is always computed and selected with a mask,
+ * so the running time does not depend on the result.
+ * Returns true if n was subtracted.
+ */
+template<ttmath::uint Limbs>
+static inline bool MontgomeryFinalSubtract(ttmath::uint *t, const ttmath::uint *n, long s, bool constantTime){
+    ttmath::uint c = 0;
+    if (constantTime) {
+        ttmath::uint diff[Limbs];
+        for (long j = 0; j < s; j++) {
+            ttmath::uint nj = n[j] + c;
+            c = (nj < c) | (t[j] < nj);
+            diff[j] = t[j] - nj;
+        }
+        c = (t[s] < c);
+        ttmath::uint mask = c - 1; // all ones if t >= n
+        for (long j = 0; j < s; j++) {
+            t[j] = (diff[j] & mask) | (t[j] & ~mask);
+        }
+        return mask & 1;
+    }
+
+    bool subtract = (t[s] != 0);
+    if (!subtract) {
+        long j = s - 1;
+        while (j > 0 && t[j] == n[j]) j--;
+        subtract = (t[j] >= n[j]);
+    }
+    if (subtract) {
+        for (long j = 0; j < s; j++) {
+            ttmath::uint nj = n[j] + c;
+            c = (nj < c);
+            c += (t[j] < nj);
+            t[j] -= nj;
+        }
+    }
+    return subtract;
+}
+
+/*
+ * Word level Montgomery product (CIOS, Koc et al.), computing a*b*r^{-1} mod n
+ * with r = 2^k directly on the limbs of a, b and n.
+ *
+ * n0 is -n^{-1} mod 2^w (w = bits per limb). All but the last reduction step clear
+ * a whole limb and shift by one word. When k is not a multiple of w, the last
+ * step only clears the remaining k mod w bits. The quotient m is therefore the
+ * same as t * n' % r, with n' = (r*r^{-1} - 1)/n as nPrime computes it, and u is the same as (t + m*n)/r, so the step 4
+ * subtractions match the reference implementation in Attack/RSAAttack.py.
+ * The rows are ttmath's MulAddVector, which uses mulx/adcx/adox where the CPU has them.
+ *
+ * Requires a, b < n < 2^k. Returns true if the final subtraction happened.
+ * See MontgomeryFinalSubtract for constantTime.
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::MontgomeryCIOS(const num &a, const num &b, const num &n, ttmath::uint n0, long k, num &u, bool constantTime){
+    const long w = TTMATH_BITS_PER_UINT;
+    const long s = (k + w - 1) / w;      // limbs in use
+    const long top = k - (s - 1) * w;    // bits cleared by the last step, (0, w]
+    ttmath::uint buffer[2*Limbs + 2] = {0};
+    ttmath::uint *t = buffer;   // t moves up a word instead of shifting down after each whole step
+    ttmath::uint c, m;
+
+    for (long i = 0; i < s; i++) {
+        // t += a_i * b
+        c = num::MulAddVector(b.table, a.table[i], s, t);
+        t[s] += c;
+        t[s+1] = (t[s] < c);
+
+        if (i < s - 1 || top == w) {
+            // t = (t + m*n) / 2^w
+            m = t[0] * n0;
+            c = num::MulAddVector(n.table, m, s, t);
+            t[s] += c;
+            t[s+1] += (t[s] < c);
+            t++;
+        }
+        else {
+            // t = (t + m*n) / 2^top, for the bits left over above the last whole limb
+            m = (t[0] * n0) & ((ttmath::uint(1) << top) - 1);
+            c = num::MulAddVector(n.table, m, s, t);
+            t[s] += c;
+            t[s+1] += (t[s] < c);
+            for (long j = 0; j <= s; j++) {
+                t[j] = (t[j] >> top) | (t[j+1] << (w - top));
+            }
+        }
+    }
+
+    bool subtract = MontgomeryFinalSubtract<Limbs>(t, n.table, s, constantTime);
+    u.SetZero();
+    for (long j = 0; j < s; j++) {
+        u.table[j] = t[j];
+    }
+    return subtract;
+}
+
+/*
+ * Montgomery Powering ladder in the Montgomery domain.
+ *
+ * Same ladder as PoweringLadder, but M is converted into Montgomery form once
+ * and every step is two constant time Montgomery products instead of two
+ * multiplications and two divisions. R0 and R1 are exchanged with a branch free
+ * conditional swap instead of branching on the exponent bit.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MontgomeryLadder(const num &message, const num &exponent, const Context &ctx){
+    if (ctx.n%2 != 1) {
+        cout << "Warning! Exponentiation failed. Modulus must be odd!";
+        return 0;
+    }
+    num R0 = ctx.rModN;
+    num R1 = MontgomeryProductConstTime(message, ctx.r2ModN, ctx);
+    long t = numBits(exponent);
+
+    // The bit 1 step is the bit 0 step with R0 and R1 exchanged.
+    // Consecutive swaps cancel, so only swap when the bit changes.
+    ttmath::uint swapped = 0;
+    for (long i = t-1; i>=0; i--) {
+        ttmath::uint bit = exponent.GetBit(i);
+        ConditionalSwap(R0, R1, swapped ^ bit);
+        swapped = bit;
+        R1 = MontgomeryProductConstTime(R0, R1, ctx);
+        R0 = MontgomeryProductConstTime(R0, R0, ctx);
+    }
+    ConditionalSwap(R0, R1, swapped);
+    return MontgomeryProductConstTime(R0, 1, ctx);
+}
+
+/*
+ * Exchanges a and b if swap is 1, leaves them if swap is 0, without branching.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::ConditionalSwap(num &a, num &b, ttmath::uint swap){
+    ttmath::uint mask = ttmath::uint(0) - swap;
+    for (ttmath::uint i = 0; i < Limbs; i++) {
+        ttmath::uint t = (a.table[i] ^ b.table[i]) & mask;
+        a.table[i] ^= t;
+        b.table[i] ^= t;
+    }
+}
+
+/*
+ * Window size for the windowed exponentiations, for an exponent of the given bit length.
+ * Balances the table precomputation against the multiplications it saves.
+ */
+static const long MaxWindowSize = 6;
+static inline long WindowSize(long bits){
+    if (bits <= 32) return 2;
+    if (bits <= 128) return 3;
+    if (bits <= 512) return 4;
+    if (bits <= 1536) return 5;
+    return 6;
+}
+
+/*
+ * Sliding window exponentiation of M raised to the power of d (mod n).
+ *
+ * Precomputes the odd powers M_bar, M_bar^3, ..., M_bar^(2^w - 1) in Montgomery form,
+ * and consumes the exponent in windows that start and end with a 1 bit.
+ * Needs fewer multiplications than ModExp, but is just as suceptible to timing attacks.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::SlidingWindow(const num &M, const num &d, const Context &ctx){
+    if (ctx.n%2 != 1) {
+        cout << "Warning! Exponentiation failed. Modulus must be odd!";
+        return 0;
+    }
+    const long bits = numBits(d);
+    const long w = WindowSize(bits);
+    num table[1 << (MaxWindowSize - 1)]; // table[i] = M_bar^(2i+1)
+    table[0] = MontgomeryProduct(M, ctx.r2ModN, ctx);
+    num M2_bar = MontgomeryProduct(table[0], table[0], ctx);
+    for (long i = 1; i < (1L << (w - 1)); i++) {
+        table[i] = MontgomeryProduct(table[i-1], M2_bar, ctx);
+    }
+
+    num x_bar = ctx.rModN;
+    bool first = true; // x_bar is still 1, so the squarings can be skipped
+    long i = bits - 1;
+    while (i >= 0) {
+        if (!d.GetBit(i)) {
+            if (!first) x_bar = MontgomeryProduct(x_bar, x_bar, ctx);
+            i--;
+            continue;
+        }
+        // Longest window d[i..l] of at most w bits that ends with a 1
+        long l = (i - w + 1 > 0) ? i - w + 1 : 0;
+        while (!d.GetBit(l)) l++;
+        long value = 0;
+        for (long j = i; j >= l; j--) {
+            value = (value << 1) | d.GetBit(j);
+        }
+        if (first) {
+            x_bar = table[value >> 1];
+            first = false;
+        }
+        else {
+            for (long j = i; j >= l; j--) {
+                x_bar = MontgomeryProduct(x_bar, x_bar, ctx);
+            }
+            x_bar = MontgomeryProduct(x_bar, table[value >> 1], ctx);
+        }
+        i = l - 1;
+    }
+    return MontgomeryProduct(x_bar, 1, ctx);
+}
+
+/*
+ * Fixed window exponentiation of M raised to the power of d (mod n).
+ *
+ * Constant time counterpart of SlidingWindow: every window of w bits costs w squarings
+ * and one multiplication, also when the window is zero. The table entry is read
+ * with a masked scan over the whole table, and the Montgomery products always
+ * do the step 4 subtraction work, so neither the timing nor the memory access
+ * pattern depends on the bits of d.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::FixedWindow(const num &M, const num &d, const Context &ctx){
+    if (ctx.n%2 != 1) {
+        cout << "Warning! Exponentiation failed. Modulus must be odd!";
+        return 0;
+    }
+    const long bits = numBits(d);
+    const long w = WindowSize(bits);
+    const long size = 1L << w;
+    num table[1 << MaxWindowSize]; // table[i] = M_bar^i
+    table[0] = ctx.rModN;
+    table[1] = MontgomeryProductConstTime(M, ctx.r2ModN, ctx);
+    for (long i = 2; i < size; i++) {
+        table[i] = MontgomeryProductConstTime(table[i-1], table[1], ctx);
+    }
+
+    num x_bar = ctx.rModN, y_bar;
+    for (long top = ((bits + w - 1) / w) * w - 1; top >= 0; top -= w) {
+        ttmath::uint value = 0;
+        for (long j = top; j > top - w; j--) {
+            value = (value << 1) | (j < bits ? d.GetBit(j) : 0);
+        }
+        for (long j = 0; j < w; j++) {
+            x_bar = MontgomeryProductConstTime(x_bar, x_bar, ctx);
+        }
+        // y_bar = table[value], touching every entry
+        y_bar.SetZero();
+        for (long i = 0; i < size; i++) {
+            ttmath::uint mask = ttmath::uint(0) - ttmath::uint(ttmath::uint(i) == value);
+            for (ttmath::uint l = 0; l < Limbs; l++) {
+                y_bar.table[l] |= table[i].table[l] & mask;
+            }
+        }
+        x_bar = MontgomeryProductConstTime(x_bar, y_bar, ctx);
+    }
+    return MontgomeryProductConstTime(x_bar, 1, ctx);
+}
+
+/*
+ * Word level Montgomery reduction (SOS, Koc et al.), computing t*r^{-1} mod n
+ * with r = 2^k for a double width t < n*r, such as the square of a number below n.
+ *
+ * The reduction steps are the same as in MontgomeryCIOS, including the partial last
+ * step when k is not a multiple of w, so u and the step 4 subtraction are the same
+ * as for the product. The carry of each row is kept in extra and added with the
+ * next row, so the running time does not depend on t.
+ * Returns true if the final subtraction happened.
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::MontgomeryReduce(const numWide &T, const num &n, ttmath::uint n0, long k, num &u, bool constantTime){
+    const long w = TTMATH_BITS_PER_UINT;
+    const long s = (k + w - 1) / w;      // limbs in use
+    const long top = k - (s - 1) * w;    // bits cleared by the last step, (0, w]
+    const long full = (top == w) ? s : s - 1; // steps clearing a whole limb
+    ttmath::uint t[2*Limbs + 2];
+    ttmath::uint c, m, x, extra = 0;
+
+    for (long j = 0; j < 2*s; j++) {
+        t[j] = T.table[j];
+    }
+    t[2*s] = t[2*s+1] = 0;
+
+    for (long i = 0; i < full; i++) {
+        // t += m*n*2^(w*i), clearing limb i
+        m = t[i] * n0;
+        c = num::MulAddVector(n.table, m, s, t + i);
+        x = t[i+s] + extra;
+        extra = (x < extra);
+        x += c;
+        extra += (x < c);
+        t[i+s] = x;
+    }
+    t[full+s] += extra;
+    t[full+s+1] += (t[full+s] < extra);
+
+    if (full < s) {
+        // t += m*n*2^(w*full), clearing the low top bits of limb full, then shift those out
+        m = (t[full] * n0) & ((ttmath::uint(1) << top) - 1);
+        c = num::MulAddVector(n.table, m, s, t + full);
+        t[full+s] += c;
+        t[full+s+1] += (t[full+s] < c);
+        for (long j = 0; j <= s; j++) {
+            t[full+j] = (t[full+j] >> top) | (t[full+j+1] << (w - top));
+        }
+    }
+
+    // u = t / 2^k is now in t[full], ..., t[full+s]
+    bool subtract = MontgomeryFinalSubtract<Limbs>(t + full, n.table, s, constantTime);
+    u.SetZero();
+    for (long j = 0; j < s; j++) {
+        u.table[j] = t[full+j];
+    }
+    return subtract;
+}
+
+/*
+ * u = a*b*r^{-1} mod n.
+ * Squarings (a and b are the same object) use the ttmath squaring kernel followed
+ * by MontgomeryReduce, everything else uses MontgomeryCIOS. Both give the same u
+ * and the same step 4 subtraction.
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::MontgomeryKernel(const num &a, const num &b, const Context &ctx, num &u, bool constantTime){
+    RSA_STATS_BEGIN();
+    bool subtract;
+    if (&a == &b) {
+        numWide t;
+        a.SqrBig(t);
+        subtract = MontgomeryReduce(t, ctx.n, ctx.n0, ctx.k, u, constantTime);
+    }
+    else {
+        subtract = MontgomeryCIOS(a, b, ctx.n, ctx.n0, ctx.k, u, constantTime);
+    }
+    RSA_STATS_END(&a == &b, subtract);
+    return subtract;
+}
+
 /*
  * Montgomery product
  */
-num Rsa::MontgomeryProduct(const num &a, const num &b, const num &nprime, const num &r, const num &n){
-    num t = a * b;
-    num m = t * nprime % r;
-    num u = (t + m*n)/r;
-    if(u >=n) { return u-n; }
-    else { return u; }
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MontgomeryProduct(const num &a, const num &b, const Context &ctx){
+    num u;
+    MontgomeryKernel(a, b, ctx, u);
+    return u;
+}
+
+/*
+ * Montgomery product that always performs the step 4 subtraction work,
+ * so its running time does not depend on the operands.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MontgomeryProductConstTime(const num &a, const num &b, const Context &ctx){
+    num u;
+    MontgomeryKernel(a, b, ctx, u, true);
+    return u;
 }
 
 /*
@@ -122,77 +1011,468 @@ num Rsa::MontgomeryProduct(const num &a, const num &b, const num &nprime, const
  * Sleeps for five millisecond if a substraction happens in step 5,
  * in order to simulate a slow device and facilitate a timing attack demonstration.
  */
-num Rsa::MontgomeryProductSleep(const num &a, const num &b, const num &nprime, const num &r, const num &n){
-    num t = a * b;
-    num m = t * nprime % r;
-    num u = (t + m*n)/r;
-    if(u >=n) {
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MontgomeryProductSleep(const num &a, const num &b, const Context &ctx){
+    num u;
+    if (MontgomeryKernel(a, b, ctx, u)) {
         this_thread::sleep_for(chrono::milliseconds(2));
-        return u-n;
     }
-    else { return u; }
+    return u;
+}
+
+/*
+ * Calculates a*b (mod n).
+ * The product is formed in double width, so nothing overflows for any n that fits in a num.
+ * Squarings (a and b are the same object) use the ttmath squaring kernel.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MulMod(const num &a, const num &b, const num &n){
+    RSA_STATS_BEGIN();
+    numWide t;
+    if (&a == &b) {
+        a.SqrBig(t);
+    }
+    else {
+        num x = a; // MulBig is not const
+        x.MulBig(b, t);     // schoolbook or Karatsuba, by the tuned limit
+    }
+    num result = Reduce(t, n);
+    RSA_STATS_END(&a == &b, false);
+    return result;
+}
+
+/*
+ * Reduces a double width number t (mod n).
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::Reduce(const numWide &t, const num &n){
+    numWide rest = t;
+    rest %= numWide(n);
+    num result;
+    result.FromUInt(rest);
+    return result;
+}
+
+/*
+ * Calculates a*b (mod n) like MulMod, reducing the product with BarrettReduce.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::MulModBarrett(const num &a, const num &b, const Barrett &ctx){
+    RSA_STATS_BEGIN();
+    numWide t;
+    if (&a == &b) {
+        a.SqrBig(t);
+    }
+    else {
+        num x = a; // MulBig is not const
+        x.MulBig(b, t);
+    }
+    num result = BarrettReduce(t, ctx);
+    RSA_STATS_END(&a == &b, false);
+    return result;
+}
+
+/*
+ * Reduces a double width number t (mod n) with Barrett reduction (HAC 14.42,
+ * on bits instead of words): q = ((t >> (k-1)) * mu) >> (k+1) is at most 2 less
+ * than t/n, so r = t - q*n is below 3n, and two subtractions of n finish it.
+ * Both subtractions are always computed and selected with a mask, so for a given
+ * modulus the same instructions run for every t.
+ * r < 3n fits in Limbs+1 words, so only the low Limbs+1 words of t - q*n are formed.
+ * t >= 4^k (only possible when t is not a product of two numbers below n)
+ * falls back to Reduce.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::BarrettReduce(const numWide &t, const Barrett &ctx){
+    typedef typename Barrett::numMu numMu;
+    ttmath::uint table_id, index;
+    if (t.FindLeadingBit(table_id, index) && long(table_id * TTMATH_BITS_PER_UINT + index) >= 2*ctx.k) {
+        return Reduce(t, ctx.n);
+    }
+
+    numWide shifted = t;
+    shifted.Rcr(ctx.k - 1);
+    numMu q;
+    q.FromUInt(shifted);
+    ttmath::UInt<2*Limbs+2> qmu;
+    q.MulBig(ctx.mu, qmu);
+    qmu.Rcr(ctx.k + 1);
+    q.FromUInt(qmu);
+
+    // qn = q*n (mod 2^(w*(Limbs+1))), one row per word of q
+    numMu qn, r, n;
+    qn.SetZero();
+    qn.table[Limbs] = num::MulAddVector(ctx.n.table, q.table[0], Limbs, qn.table);
+    for (ttmath::uint i = 1; i <= Limbs; i++) {
+        ttmath::uint size = Limbs + 1 - i;
+        num::MulAddVector(ctx.n.table, q.table[i], size < Limbs ? size : Limbs, qn.table + i);
+    }
+    r.FromUInt(t);
+    r.Sub(qn);
+    n.FromUInt(ctx.n);
+    for (int step = 0; step < 2; step++) {
+        numMu diff = r;
+        ttmath::uint mask = diff.Sub(n) - 1; // all ones if r >= n
+        for (ttmath::uint i = 0; i <= Limbs; i++) {
+            r.table[i] = (diff.table[i] & mask) | (r.table[i] & ~mask);
+        }
+    }
+    num result;
+    result.FromUInt(r);
+    return result;
 }
 
 /*
- * Calculates r^{-1} and n' as used in Montgomery exponentiation,
- * as well as the number of bits in n.
+ * Calculates r = 2^k and n' as used in Montgomery exponentiation,
+ * where k is the number of bits in n.
  */
-void Rsa::nPrime(const num n, num &r, num &nPrime){
-    r = 2;
-    r.Pow(numBits(n));
-    num rInverse = ModInverse(r, n);
-    nPrime = (r*rInverse - 1)/n;
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::nPrime(const num n, numWide &r, num &nPrime){
+    r.SetZero();
+    r.SetBit(numBits(n));
+    num rInverse = ModInverse(Reduce(r, n), n);
+    numWide t = rInverse;
+    t.Rcl(numBits(n)); // r * r^{-1}
+    t.SubOne();
+    t /= numWide(n);
+    nPrime.FromUInt(t);
 }
 
 /*
- * Calculates the modular inverse of a (mod b).
+ * x/2 (mod m), for odd m. An odd x is made even by adding m first,
+ * with the carry of that addition shifted back in at the top.
+ */
+template<ttmath::uint Limbs>
+static inline void HalveMod(ttmath::UInt<Limbs> &x, const ttmath::UInt<Limbs> &m){
+    ttmath::uint c = 0;
+    if (x.IsTheLowestBitSet()) {
+        c = x.Add(m);
+    }
+    x.Rcr(1, c);
+}
+
+/*
+ * x - y (mod m), for x, y < m.
+ */
+template<ttmath::uint Limbs>
+static inline void SubMod(ttmath::UInt<Limbs> &x, const ttmath::UInt<Limbs> &y, const ttmath::UInt<Limbs> &m){
+    if (x.Sub(y)) {
+        x.Add(m);
+    }
+}
+
+/*
+ * Calculates the modular inverse of a (mod b), or 0 if there is none.
  *
- * http://rosettacode.org/wiki/Modular_inverse#C
+ * Binary extended GCD (HAC 14.61, for odd b): only subtractions and shifts by
+ * one bit on the limbs, where Euclid needs a division and a multiplication
+ * per step. The coefficients are kept reduced (mod b), since num is unsigned.
+ * An even b (e (mod theta)) is turned into the odd modulus a:
+ * from y = b^{-1} (mod a), b*y - 1 = a*t, and a^{-1} = b - t (mod b).
  */
-num Rsa::ModInverse(num a, num b){
-    num b0 = b, t, q;
-    num x0 = 0, x1 = 1;
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::ModInverse(num a, num b){
     if (b == 1) return 1;
-    while (a > 1) {
-        q = a / b;
-        t = b, b = a % b; a = t;
-        t = x0, x0 = x1 - q * x0, x1 = t;
+    if (b == 0) return 0;
+    if (!b.IsTheLowestBitSet()) {
+        if (!a.IsTheLowestBitSet()) return 0; // both even
+        if (a == 1) return 1;
+        num y = ModInverse(b % a, a);
+        if (y == 0) return 0;
+        numWide t;
+        b.MulBig(y, t);
+        t.SubOne();
+        t /= numWide(a);
+        num x;
+        x.FromUInt(t);
+        return b - x;
+    }
+
+    if (a >= b) a %= b;
+    num u = a, v = b;
+    num x1 = 1, x2 = 0;
+    while (u != 1 && v != 1) {
+        if (u.IsZero()) return 0; // gcd(a, b) = v > 1
+        while (!u.IsTheLowestBitSet()) {
+            u.Rcr(1);
+            HalveMod(x1, b);
+        }
+        while (!v.IsTheLowestBitSet()) {
+            v.Rcr(1);
+            HalveMod(x2, b);
+        }
+        if (u >= v) {
+            u.Sub(v);
+            SubMod(x1, x2, b);
+        }
+        else {
+            v.Sub(u);
+            SubMod(x2, x1, b);
+        }
+    }
+    return (u == 1) ? x1 : x2;
+}
+
+/*
+ * -n^{-1} mod 2^w (w = bits per limb) for odd n, the n0 of the Montgomery routines.
+ * Newton's iteration x = x*(2 - n*x) doubles the correct low bits of n^{-1},
+ * starting from the 3 that n itself gets right.
+ */
+template<ttmath::uint Limbs>
+ttmath::uint Rsa<Limbs>::NegInverseWord(ttmath::uint n){
+    ttmath::uint x = n;
+    for (ttmath::uint bits = 3; bits < TTMATH_BITS_PER_UINT; bits *= 2) {
+        x *= 2 - n * x;
     }
-    if (x1 < 0) x1 += b0;
-    return x1;
+    return 0 - x;
+}
+
+/*
+ * One round of the Miller-Rabin test of ctx.n with base a, 1 < a < n-1.
+ * Returns false if a proves n composite, true if n is a strong probable
+ * prime to base a. n-1 = 2^s * t with t odd, and a^t is squared s-1 times
+ * in the Montgomery domain, where -1 is n - r (mod n).
+ */
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::MillerRabin(const num &a, const Context &ctx){
+    num t = ctx.n;
+    t.SubOne();
+    long s = 0;
+    while (!t.IsTheLowestBitSet()) {
+        t.Rcr(1);
+        s++;
+    }
+    const num one = ctx.rModN, minusOne = ctx.n - ctx.rModN;
+    num x = MontgomeryProduct(ModExp(a, t, ctx), ctx.r2ModN, ctx);
+    if (x == one || x == minusOne) {
+        return true;
+    }
+    for (long i = 1; i < s; i++) {
+        x = MontgomeryProduct(x, x, ctx);
+        if (x == minusOne) {
+            return true;
+        }
+        if (x == one) {
+            return false; // a nontrivial square root of 1
+        }
+    }
+    return false;
 }
 
 /*
  * Ccounts the number of bits required to represent a decimal number
+ * Zero needs no bits.
  */
-long Rsa::numBits(const num &n){
-    ttmath::Big<32,32> k;
-    k.Log(n, 2);
-    k = ttmath::Floor(k);
-    return k.ToInt() + 1;
+template<ttmath::uint Limbs>
+long Rsa<Limbs>::numBits(const num &n){
+    ttmath::uint table_id, index;
+    if (!n.FindLeadingBit(table_id, index)) {
+        return 0;
+    }
+    return table_id * TTMATH_BITS_PER_UINT + index + 1;
+}
+
+/*
+ * Encrypts a message (number) with the public key.
+ * A public exponent that fits in a word uses ModExpPublic, larger ones
+ * the selected exponentiation algorithm.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::encrypt(const num &M){
+    if (eWord != 0) {
+        return ModExpPublic(M, eWord, mont);
+    }
+    return (this->ef)(M, e, mont);
 }
 
 /*
- * Encrypts a message (number) with the public key,
- * using the selected exponentiation algorithm.
+ * Checks a signature S of M with the public key.
  */
-num Rsa::encrypt(const num &M){
-    return (this->ef)(M, e, n);
+template<ttmath::uint Limbs>
+bool Rsa<Limbs>::verify(const num &M, const num &S){
+    return encrypt(S) == M;
+}
+
+/*
+ * Sets eWord to e if it fits in a word, or 0 if it does not.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::setPublicExponent(){
+    eWord = (numBits(e) <= long(TTMATH_BITS_PER_UINT)) ? e.table[0] : 0;
 }
 
 /*
  * Decrypts a message (encrypted by the public key), using the private key.
  * Uses the selected exponentiation algorithm.
  */
-num Rsa::decrypt(const num &C){
-    return  (this->ef)(C, d, n);
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::decrypt(const num &C){
+    if (crt) {
+        return decryptCrt(C);
+    }
+    return  (this->ef)(C, d, mont);
+}
+
+/*
+ * Spins between the CrtWorker jobs, in pause instructions, before sleeping.
+ * Not on a single core, where the spinning would only delay the other half.
+ */
+static const int CrtWorkerSpin = (thread::hardware_concurrency() > 1) ? 1 << 12 : 0;
+
+static inline void cpuRelax(){
+#if defined(__x86_64__) && defined(__GNUC__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+CrtWorker::~CrtWorker(){
+    if (!thread.joinable()) {
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void CrtWorker::start(Job job, void *arg){
+    if (!thread.joinable()) {
+        thread = std::thread(&CrtWorker::loop, this);
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        this->job = job;
+        this->arg = arg;
+        pending = true;
+    }
+    cond.notify_all();
+}
+
+void CrtWorker::wait(){
+    for (int i = 0; i < CrtWorkerSpin && pending.load(memory_order_acquire); i++) {
+        cpuRelax();
+    }
+    if (pending.load(memory_order_acquire)) {
+        unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return !pending.load(); });
+    }
+}
+
+void CrtWorker::loop(){
+    for (;;) {
+        for (int i = 0; i < CrtWorkerSpin && !pending.load(memory_order_acquire); i++) {
+            cpuRelax();
+        }
+        Job next;
+        void *nextArg;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]{ return pending.load() || stopping; });
+            if (!pending) {
+                return;
+            }
+            next = job;
+            nextArg = arg;
+        }
+        next(nextArg);
+        {
+            lock_guard<std::mutex> lock(mutex);
+            pending = false;
+        }
+        cond.notify_all();
+    }
+}
+
+/*
+ * Decrypts using the Chinese Remainder Theorem.
+ * Two half size exponentiations (mod p) and (mod q), recombined with Garner's formula.
+ * With setCrtThreads(true) the exponentiation (mod q) runs on the CrtWorker.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::decryptCrt(const num &C){
+    num m1, m2;
+    numWide c = C;
+    if (crtThreads) {
+        struct HalfQ {
+            const Rsa *rsa;
+            const numWide *c;
+            num *m2;
+            static void run(void *job){
+                const HalfQ &half = *(const HalfQ*)job;
+                const Rsa &rsa = *half.rsa;
+                *half.m2 = ModExp(BarrettReduce(*half.c, rsa.montQ.barrett), rsa.dQ, rsa.montQ);
+            }
+        } half = {this, &c, &m2};
+        crtWorker.start(&HalfQ::run, &half);
+        m1 = ModExp(BarrettReduce(c, montP.barrett), dP, montP);
+        crtWorker.wait();
+    }
+    else {
+        m1 = ModExp(BarrettReduce(c, montP.barrett), dP, montP);
+        m2 = ModExp(BarrettReduce(c, montQ.barrett), dQ, montQ);
+    }
+
+    // h = qInv * (m1 - m2) (mod p), M = m2 + h*q
+    num m2p = BarrettReduce(numWide(m2), montP.barrett);
+    num h = (m1 >= m2p) ? m1 - m2p : m1 + (p - m2p);
+    h = MulModBarrett(qInv, h, montP.barrett);
+    return m2 + h * q;
+}
+
+/*
+ * Sets the private exponent d, and the CRT values derived from it.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::setPrivateExponent(const num &d){
+    this->d = d;
+    if (p == 0 || q == 0) {
+        return; // public key only, there is nothing to precompute for CRT
+    }
+    dP = d % (p - 1);
+    dQ = d % (q - 1);
+    qInv = ModInverse(q % p, p);
+}
+
+/*
+ * Signs a message using the private key, with ModExpCount.
+ * subtractions is set to the number of step 4 subtractions,
+ * i.e. the number of sleeps MODEXP_SLEEP would have made.
+ */
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::signCounted(const num &M, long &subtractions){
+    return ModExpCount(M, d, mont, subtractions);
+}
+
+/*
+ * Signs count messages using the private key, with ModExpBatch when
+ * AVX-512 IFMA is there and with ModExpCount otherwise. Same results as
+ * signCounted on every message, subtractions (if given) included.
+ */
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::signBatch(const num *M, num *S, size_t count, long *subtractions){
+    if (!BatchAvailable()) {
+        long scratch;
+        for (size_t i = 0; i < count; i++) {
+            S[i] = signCounted(M[i], subtractions ? subtractions[i] : scratch);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i += Batch::Lanes) {
+        const int lanes = int(std::min<size_t>(Batch::Lanes, count - i));
+        ModExpBatch(M + i, lanes, d, batch, S + i, subtractions ? subtractions + i : NULL);
+    }
 }
 
 /*
  * Signs a message using the private key
  * This is equivalent to decrypting a ciphertext
  */
-num Rsa::sign(const num &M){
+template<ttmath::uint Limbs>
+typename Rsa<Limbs>::num Rsa<Limbs>::sign(const num &M){
     return decrypt(M);
 }
 
@@ -200,16 +1480,40 @@ num Rsa::sign(const num &M){
  * Print the keys we are using.
  * Used for debugging.
  */
-void Rsa::printKeys(){
+template<ttmath::uint Limbs>
+void Rsa<Limbs>::printKeys(){
     cout << "p:\t" << p << endl;
     cout << "q:\t" << q << endl;
     cout << "theta:\t" << theta << endl;
     cout << "n (pubkey):\t" << n << endl;
     cout << "e:(pubkey)\t" << e << endl;
-    cout << "d:(privkey)\t" << d << endl << endl;
+    cout << "d:(privkey)\t" << d << endl;
+    cout << "dP:\t" << dP << endl;
+    cout << "dQ:\t" << dQ << endl;
+    cout << "qInv:\t" << qInv << endl << endl;
     printf("d as bit string:\n");
     for (int i = numBits(d)-1; i>=0; i--) {
         cout << d.GetBit(i);
     }
     cout << endl;
-}
\ No newline at end of file
+}
+
+/*
+ * The key sizes csv, and anything else linking rsa.cpp, can select.
+ */
+template struct MontgomeryContext<RSA_LIMBS(512)>;
+template struct MontgomeryContext<RSA_LIMBS(1024)>;
+template struct MontgomeryContext<RSA_LIMBS(2048)>;
+template struct MontgomeryContext<RSA_LIMBS(4096)>;
+template struct BarrettContext<RSA_LIMBS(512)>;
+template struct BarrettContext<RSA_LIMBS(1024)>;
+template struct BarrettContext<RSA_LIMBS(2048)>;
+template struct BarrettContext<RSA_LIMBS(4096)>;
+template struct BatchContext<RSA_LIMBS(512)>;
+template struct BatchContext<RSA_LIMBS(1024)>;
+template struct BatchContext<RSA_LIMBS(2048)>;
+template struct BatchContext<RSA_LIMBS(4096)>;
+template class Rsa<RSA_LIMBS(512)>;
+template class Rsa<RSA_LIMBS(1024)>;
+template class Rsa<RSA_LIMBS(2048)>;
+template class Rsa<RSA_LIMBS(4096)>;
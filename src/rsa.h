@@ -10,48 +10,387 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 #include "lib/ttmath.h"
-class Rsa;
-typedef ttmath::Int<16> num; // 16 words. 16*64 = 1024 bit
-typedef num (*expFunc)(const num&, const num&, const num&);
+
+/*
+ * Number of limbs (ttmath words) in a num that holds a key of the given size.
+ * Rsa is instantiated for 512, 1024, 2048 and 4096 bit keys, see rsa.cpp.
+ */
+#define RSA_LIMBS(bits) ((bits) / TTMATH_BITS_PER_UINT)
+
+/*
+ * Values used by Barrett reduction that only depend on the modulus.
+ * A double width t < 4^k is reduced with two multiplications, by mu and by n,
+ * and two subtractions of n that are always computed, instead of a division.
+ */
+template<ttmath::uint Limbs>
+struct BarrettContext {
+    typedef ttmath::UInt<Limbs> num;
+    typedef ttmath::UInt<Limbs+1> numMu;
+
+    num n;              // modulus
+    numMu mu;           // floor(4^k / n), has k+1 bits
+    long k;             // number of bits in n
+
+    BarrettContext():k(0){}
+    BarrettContext(const num &n);
+};
+
+/*
+ * Values used by the Montgomery routines that only depend on the modulus.
+ * Built once per key instead of on every exponentiation.
+ */
+template<ttmath::uint Limbs>
+struct MontgomeryContext {
+    typedef ttmath::UInt<Limbs> num;
+    typedef ttmath::UInt<2*Limbs> numWide;
+
+    num n;              // modulus
+    numWide r;          // 2^k, does not fit in a num when k is the full width
+    num rModN;          // r mod n, i.e. 1 in Montgomery form
+    num r2ModN;         // r^2 mod n, used to convert into Montgomery form
+    ttmath::uint n0;    // -n^{-1} mod 2^w, w = bits per limb
+    long k;             // number of bits in n
+    BarrettContext<Limbs> barrett;  // for the reductions outside the Montgomery domain
+
+    MontgomeryContext():n0(0),k(0){}
+    MontgomeryContext(const num &n);
+};
+
+/*
+ * ModExp stopped between two bits of the exponent, for code that needs the
+ * exponentiation one bit at a time, like the timing attack.
+ * ModExpTry computes the next square and product once, so that both choices
+ * of the next bit are available, and ModExpCommit picks one without more work.
+ */
+template<ttmath::uint Limbs>
+struct ModExpState {
+    typedef ttmath::UInt<Limbs> num;
+
+    num M_bar;      // M in Montgomery form
+    num x_bar;      // M raised to the bits so far, in Montgomery form
+    num square;     // x_bar^2, from the last ModExpTry
+    num product;    // x_bar^2 * M_bar, from the last ModExpTry
+};
+
+/*
+ * BatchLanes numbers with the same modulus, for the batch Montgomery kernel.
+ * The numbers are in radix 2^52, limb sliced: d[j][l] is digit j of lane l,
+ * so one vector load gets the same digit of every lane.
+ */
+template<ttmath::uint Limbs>
+struct BatchNum {
+    static const int Lanes = 8;
+    static const int Digits = (Limbs * TTMATH_BITS_PER_UINT + 51) / 52 + 1;
+
+    uint64_t d[Digits][Lanes];
+};
+
+/*
+ * The MontgomeryContext values in radix 2^52, for the batch kernel.
+ * r is the same 2^k, so the batch kernel gives the same products and the
+ * same step 4 subtractions as MontgomeryKernel.
+ */
+template<ttmath::uint Limbs>
+struct BatchContext {
+    typedef BatchNum<Limbs> Batch;
+
+    int digits;                     // 52 bit digits in n
+    int lastBits;                   // bits reduced in the last step, k - 52*(digits - 1)
+    uint64_t n0;                    // -n^{-1} mod 2^52
+    uint64_t n[Batch::Digits];      // n, one digit per entry
+    Batch rModN, r2ModN, one;       // in every lane
+
+    BatchContext():digits(0),lastBits(0),n0(0){}
+    BatchContext(const MontgomeryContext<Limbs> &ctx);
+};
+
+/*
+ * ModExpState for BatchLanes messages at once.
+ */
+template<ttmath::uint Limbs>
+struct ModExpBatchState {
+    typedef BatchNum<Limbs> Batch;
+
+    Batch M_bar, x_bar, square, product;
+};
+
+/*
+ * Operation counts of the exponentiation routines on the calling thread, from
+ * MontgomeryKernel, MulMod and MulModBarrett. Only kept when compiled with
+ * RSA_STATS (cmake -DRSA_STATS=ON); otherwise Enabled is false and the
+ * routines do not touch them. The batch kernel is not counted.
+ */
+struct RsaStats {
+#ifdef RSA_STATS
+    static const bool Enabled = true;
+#else
+    static const bool Enabled = false;
+#endif
+
+    uint64_t products;          // modular products, squarings included
+    uint64_t squarings;
+    uint64_t subtractions;      // step 4 subtractions of the Montgomery products
+    uint64_t squareCycles;      // time stamp counter ticks spent in squarings, 0 without a counter
+    uint64_t multiplyCycles;    // and in the other products
+
+    RsaStats(){ reset(); }
+
+    void reset(){
+        products = squarings = subtractions = squareCycles = multiplyCycles = 0;
+    }
+
+    void record(bool square, bool subtraction, uint64_t ticks){
+        products++;
+        subtractions += subtraction;
+        if (square) {
+            squarings++;
+            squareCycles += ticks;
+        }
+        else {
+            multiplyCycles += ticks;
+        }
+    }
+
+    static RsaStats &current(){
+        static thread_local RsaStats stats;
+        return stats;
+    }
+};
+
 enum ExpType {
     POWERLADDER,
     MODEXP,
-    MODEXP_SLEEP
+    MODEXP_SLEEP,
+    MODEXP_CRT,
+    SLIDING_WINDOW,
+    FIXED_WINDOW,
+    MONTGOMERY_LADDER,
+    BARRETT_LADDER
+};
+
+template<ExpType type> struct ExpSelect;
+
+/*
+ * Thread that runs the half (mod q) of decryptCrt with setCrtThreads(true).
+ * Started by the first job and kept until its owner is destroyed, so a
+ * signature does not pay for creating and joining a thread. Between jobs it
+ * spins for a few microseconds before it sleeps, to pick up the next one of
+ * back to back signatures without a wakeup.
+ * A copy of the owner starts a thread of its own instead of sharing it.
+ */
+class CrtWorker {
+public:
+    typedef void (*Job)(void *arg);
+
+    CrtWorker():job(NULL),arg(NULL),pending(false),stopping(false){}
+    CrtWorker(const CrtWorker &):CrtWorker(){}
+    CrtWorker &operator=(const CrtWorker &){ return *this; }
+    ~CrtWorker();
+
+    /*
+     * Runs job(arg) on the thread. At most one job at a time.
+     */
+    void start(Job job, void *arg);
+
+    /*
+     * Returns when the job passed to start is done.
+     */
+    void wait();
+
+private:
+    void loop();
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    Job job;
+    void *arg;
+    std::atomic<bool> pending;  // a job is started and not done
+    bool stopping;
 };
 
+/*
+ * RSA on keys of up to Limbs*TTMATH_BITS_PER_UINT bits.
+ * num is sized to the key, so every ttmath loop runs over exactly Limbs words.
+ */
+template<ttmath::uint Limbs>
 class Rsa {
+public:
+    typedef ttmath::UInt<Limbs> num;          // Limbs words
+    typedef ttmath::UInt<2*Limbs> numWide;    // Double width, holds the product of two nums
+    typedef MontgomeryContext<Limbs> Context;
+    typedef BarrettContext<Limbs> Barrett;
+    typedef ModExpState<Limbs> State;
+    typedef BatchNum<Limbs> Batch;
+    typedef BatchContext<Limbs> BatchCtx;
+    typedef ModExpBatchState<Limbs> BatchState;
+    typedef num (*expFunc)(const num&, const num&, const Context&);
 
 private:
+    template<ExpType> friend struct ExpSelect;
     num p, q, theta;
+    num dP, dQ, qInv;   // CRT exponents, and q^{-1} (mod p)
     expFunc ef;
+    bool crt, crtThreads;
+    CrtWorker crtWorker;
+    Context mont, montP, montQ;
+    BatchCtx batch;
+    ttmath::uint eWord;     // e if it fits in a word, for ModExpPublic, else 0
+    void setPublicExponent();
 public:
     /* These could probably be in a RSAMath module */
-    static num MontgomeryProduct(const num &a, const num &b, const num &nprime, const num &r, const num &n);
-    static num MontgomeryProductSleep(const num &a, const num &b, const num &nprime, const num &r, const num &n);
-    static void nPrime(const num n, num &r, num &nPrime);
-    static num ModExp(const num &M, const num &d, const num &n);
-    static num ModExpSleep(const num &M, const num &d, const num &n);
-    static num PoweringLadder(const num &M, const num &d, const num &n);
+    static num MontgomeryProduct(const num &a, const num &b, const Context &ctx);
+    static num MontgomeryProductSleep(const num &a, const num &b, const Context &ctx);
+    static num MontgomeryProductConstTime(const num &a, const num &b, const Context &ctx);
+    static bool MontgomeryCIOS(const num &a, const num &b, const num &n, ttmath::uint n0, long k, num &u, bool constantTime = false);
+    static bool MontgomeryReduce(const numWide &t, const num &n, ttmath::uint n0, long k, num &u, bool constantTime = false);
+    static bool MontgomeryKernel(const num &a, const num &b, const Context &ctx, num &u, bool constantTime = false);
+    static num MulMod(const num &a, const num &b, const num &n);
+    static num Reduce(const numWide &t, const num &n);
+    static num BarrettReduce(const numWide &t, const Barrett &ctx);
+    static num MulModBarrett(const num &a, const num &b, const Barrett &ctx);
+    static void nPrime(const num n, numWide &r, num &nPrime);
+    static ttmath::uint NegInverseWord(ttmath::uint n);
+    static num ModExp(const num &M, const num &d, const Context &ctx);
+    static num ModExpPublic(const num &M, ttmath::uint e, const Context &ctx);
+    static num ModExpSleep(const num &M, const num &d, const Context &ctx);
+    static num ModExpCount(const num &M, const num &d, const Context &ctx, long &subtractions);
+    static void ModExpBegin(const num &M, const Context &ctx, State &state);
+    static bool ModExpTry(State &state, const Context &ctx);
+    static void ModExpCommit(State &state, bool bit);
+    static bool ModExpStep(State &state, bool bit, const Context &ctx);
+    static num ModExpEnd(const State &state, const Context &ctx);
+    static bool BatchAvailable();
+    static void BatchLoad(Batch &x, int lane, const num &value);
+    static num BatchStore(const Batch &x, int lane);
+    static unsigned MontgomeryBatch(const Batch &a, const Batch &b, const BatchCtx &ctx, Batch &u);
+    static void ModExpBatch(const num *M, int lanes, const num &d, const BatchCtx &ctx, num *result, long *subtractions = NULL);
+    static void ModExpBatchBegin(const num *M, int lanes, const BatchCtx &ctx, BatchState &state);
+    static unsigned ModExpBatchTry(BatchState &state, const BatchCtx &ctx);
+    static void ModExpBatchCommit(BatchState &state, bool bit);
+    static unsigned ModExpBatchStep(BatchState &state, bool bit, const BatchCtx &ctx);
+    static num PoweringLadder(const num &M, const num &d, const Context &ctx);
+    static num PoweringLadderBarrett(const num &M, const num &d, const Context &ctx);
+    static num SlidingWindow(const num &M, const num &d, const Context &ctx);
+    static num FixedWindow(const num &M, const num &d, const Context &ctx);
+    static num MontgomeryLadder(const num &M, const num &d, const Context &ctx);
+    static void ConditionalSwap(num &a, num &b, ttmath::uint swap);
     static num ModInverse(const num number, const num n);
+    static bool MillerRabin(const num &a, const Context &ctx);
     static long numBits(const num &n);
 public:
     num e, n, d;
     Rsa(const num p, const num q, const num e):p(p),q(q),e(e){
         n = p*q;
         theta = (p-1)*(q-1);
-        d = ModInverse(e, theta);
+        mont = Context(n);
+        montP = Context(p);
+        montQ = Context(q);
+        batch = BatchCtx(mont);
+        setPublicExponent();
+        setPrivateExponent(ModInverse(e, theta));
+        ef = &Rsa::ModExp;
+        crt = crtThreads = false;
+    }
+    /*
+     * Public key only, e.g. to check a recovered private exponent with sign.
+     * p and q are unknown, so CRT can not be used.
+     */
+    Rsa(const num n, const num e):p(0),q(0),theta(0),e(e),n(n),d(0){
+        mont = Context(n);
+        batch = BatchCtx(mont);
+        setPublicExponent();
         ef = &Rsa::ModExp;
+        crt = crtThreads = false;
     }
-    Rsa(){}
+    Rsa():ef(&Rsa::ModExp),crt(false),crtThreads(false),eWord(0){}
 
     void printKeys();
     num encrypt(const num &M);
     num decrypt(const num &C);
+    num decryptCrt(const num &C);
     num sign(const num &M);
+    bool verify(const num &M, const num &S);
+    num signCounted(const num &M, long &subtractions);
+    void signBatch(const num *M, num *S, size_t count, long *subtractions = NULL);
     void setExpFunc(const ExpType);
+    void setPrivateExponent(const num &d);
+    void setCrtThreads(bool threads){ crtThreads = threads; }
+
+    /*
+     * Signs with the exponentiation routine for type, chosen at compile time
+     * instead of through the function pointer set by setExpFunc.
+     */
+    template<ExpType type>
+    num sign(const num &M){
+        return ExpSelect<type>::sign(*this, M);
+    }
+};
+
+/*
+ * Compile time mapping from ExpType to the Rsa exponentiation routine.
+ */
+template<> struct ExpSelect<MODEXP> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::ModExp(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<MODEXP_SLEEP> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::ModExpSleep(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<POWERLADDER> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::PoweringLadder(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<BARRETT_LADDER> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::PoweringLadderBarrett(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<SLIDING_WINDOW> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::SlidingWindow(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<FIXED_WINDOW> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::FixedWindow(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<MONTGOMERY_LADDER> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return Rsa<Limbs>::MontgomeryLadder(M, rsa.d, rsa.mont);
+    }
+};
+
+template<> struct ExpSelect<MODEXP_CRT> {
+    template<ttmath::uint Limbs>
+    static ttmath::UInt<Limbs> sign(Rsa<Limbs> &rsa, const ttmath::UInt<Limbs> &M){
+        return rsa.decryptCrt(M);
+    }
 };
 
 #endif /* defined(__rsa__rsa__) */
@@ -0,0 +1,526 @@
+//
+//  test.cpp
+//  rsa
+//
+//  Regression checks of the Rsa math against plain ttmath, and of the
+//  binary dataset format, run by ctest.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rsa.h"
+#include "dataset.h"
+#include "keygen.h"
+#include "random.h"
+#include "threadpool.h"
+#include "timer.h"
+
+static int failures = 0;
+
+/*
+ * Counts and prints a failed check.
+ */
+static void check(bool ok, const char *format, ...){
+    if (ok) {
+        return;
+    }
+    failures++;
+    va_list args;
+    va_start(args, format);
+    printf("FAIL: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+template<ttmath::uint Limbs>
+static ttmath::UInt<2*Limbs> widen(const ttmath::UInt<Limbs> &x){
+    ttmath::UInt<2*Limbs> wide;
+    wide.SetZero();
+    for (ttmath::uint i = 0; i < Limbs; i++) {
+        wide.table[i] = x.table[i];
+    }
+    return wide;
+}
+
+template<ttmath::uint Limbs>
+static ttmath::UInt<Limbs> narrow(const ttmath::UInt<2*Limbs> &x){
+    ttmath::UInt<Limbs> result;
+    for (ttmath::uint i = 0; i < Limbs; i++) {
+        result.table[i] = x.table[i];
+    }
+    return result;
+}
+
+/*
+ * x*y mod n with the ttmath schoolbook multiplication and division,
+ * none of the kernels under test.
+ */
+template<ttmath::uint Limbs>
+static ttmath::UInt<Limbs> referenceMulMod(const ttmath::UInt<Limbs> &x, const ttmath::UInt<Limbs> &y,
+                                          const ttmath::UInt<Limbs> &n){
+    ttmath::UInt<Limbs> a = x;
+    ttmath::UInt<2*Limbs> product;
+    a.MulBig(y, product, 2);
+    return narrow<Limbs>(product % widen(n));
+}
+
+/*
+ * M^d mod n, square and multiply on referenceMulMod.
+ */
+template<ttmath::uint Limbs>
+static ttmath::UInt<Limbs> referenceModExp(const ttmath::UInt<Limbs> &M, const ttmath::UInt<Limbs> &d,
+                                          const ttmath::UInt<Limbs> &n){
+    ttmath::UInt<Limbs> result = 1, base = narrow<Limbs>(widen(M) % widen(n));
+    for (long i = Rsa<Limbs>::numBits(d) - 1; i >= 0; i--) {
+        result = referenceMulMod(result, result, n);
+        if (d.GetBit(i)) {
+            result = referenceMulMod(result, base, n);
+        }
+    }
+    return narrow<Limbs>(widen(result) % widen(n));
+}
+
+/*
+ * gcd(a, b) by Euclid's algorithm.
+ */
+template<ttmath::uint Limbs>
+static ttmath::UInt<Limbs> referenceGcd(ttmath::UInt<Limbs> a, ttmath::UInt<Limbs> b){
+    while (b != 0) {
+        ttmath::UInt<Limbs> rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+/*
+ * A key with a bits bit modulus, the messages to sign with it, M[0..2] being
+ * 0, 1 and n-1, and their signatures by referenceModExp.
+ */
+template<ttmath::uint Limbs>
+struct Key {
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+
+    num p, q;
+    RsaN rsa;
+    long keyBits;
+    std::vector<num> M, expected;
+    Xoshiro256 rng;
+
+    Key(long bits, int messages, uint64_t seed):rng(seed){
+        ThreadPool pool(1);
+        const num e = 65537;
+        p = randomPrime<Limbs>(bits / 2, e, pool, rng);
+        do {
+            q = randomPrime<Limbs>(bits - bits / 2, e, pool, rng);
+        } while (q == p);
+        rsa = RsaN(p, q, e);
+        keyBits = RsaN::numBits(rsa.n);
+        printf("%4ld bit key in %4u bit numbers\n", keyBits, unsigned(Limbs * TTMATH_BITS_PER_UINT));
+        M.resize(messages);
+        expected.resize(messages);
+        for (int i = 0; i < messages; i++) {
+            M[i] = bigrand(rsa.n, rng);
+        }
+        M[0] = 0;
+        M[1] = 1;
+        M[2] = rsa.n - 1;
+        for (int i = 0; i < messages; i++) {
+            expected[i] = referenceModExp(M[i], rsa.d, rsa.n);
+        }
+    }
+};
+
+/*
+ * Keys that fill their numbers, and keys that leave the top limbs partly
+ * or wholly empty, for the last step of the Montgomery products.
+ */
+struct Keys {
+    Key<RSA_LIMBS(512)> k40, k330, k512;
+    Key<RSA_LIMBS(1024)> k1000, k1024;
+    Key<RSA_LIMBS(2048)> k1536, k2048;
+    Key<RSA_LIMBS(4096)> k4096;
+
+    Keys():k40(40, 16, 1), k330(330, 16, 2), k512(512, 16, 3), k1000(1000, 8, 4), k1024(1024, 8, 5),
+           k1536(1536, 4, 6), k2048(2048, 4, 7), k4096(4096, 4, 8){}
+};
+
+#define FOR_EACH_KEY(keys, test) \
+    do { \
+        test(keys.k40); test(keys.k330); test(keys.k512); test(keys.k1000); test(keys.k1024); \
+        test(keys.k1536); test(keys.k2048); test(keys.k4096); \
+    } while (0)
+
+/*
+ * The CIOS Montgomery product against referenceMulMod, and the square and
+ * multiply exponentiations built on it.
+ */
+template<ttmath::uint Limbs>
+static void testMontgomery(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    const typename RsaN::Context ctx(key.rsa.n);
+    for (size_t i = 0; i + 1 < key.M.size(); i++) {
+        const num &a = key.M[i], &b = key.M[i + 1];
+        // a*r*b/r, back out of the Montgomery domain in the same product
+        const num product = RsaN::MontgomeryProduct(RsaN::MontgomeryProduct(a, ctx.r2ModN, ctx), b, ctx);
+        check(product == referenceMulMod(a, b, key.rsa.n), "MontgomeryProduct, %ld bits, messages %d and %d",
+              key.keyBits, int(i), int(i + 1));
+    }
+    for (size_t i = 0; i < key.M.size(); i++) {
+        check(key.rsa.template sign<MODEXP>(key.M[i]) == key.expected[i], "MODEXP, %ld bits, message %d",
+              key.keyBits, int(i));
+        check(key.rsa.template sign<POWERLADDER>(key.M[i]) == key.expected[i], "POWERLADDER, %ld bits, message %d",
+              key.keyBits, int(i));
+    }
+    if (key.keyBits <= 64) {
+        // Really sleeps for every subtraction, only affordable for a small key.
+        check(key.rsa.template sign<MODEXP_SLEEP>(key.M[3]) == key.expected[3], "MODEXP_SLEEP, %ld bits",
+              key.keyBits);
+    }
+}
+
+/*
+ * The CRT exponentiation, called directly, through sign, and with the two
+ * halves on two threads.
+ */
+template<ttmath::uint Limbs>
+static void testCrt(Key<Limbs> &key){
+    Rsa<Limbs> threaded = key.rsa;
+    threaded.setCrtThreads(true);
+    threaded.setExpFunc(MODEXP_CRT);
+    for (size_t i = 0; i < key.M.size(); i++) {
+        check(key.rsa.decryptCrt(key.M[i]) == key.expected[i], "decryptCrt, %ld bits, message %d", key.keyBits,
+              int(i));
+        check(key.rsa.template sign<MODEXP_CRT>(key.M[i]) == key.expected[i], "MODEXP_CRT, %ld bits, message %d",
+              key.keyBits, int(i));
+        check(threaded.sign(key.M[i]) == key.expected[i], "MODEXP_CRT on two threads, %ld bits, message %d",
+              key.keyBits, int(i));
+    }
+}
+
+/*
+ * The sliding and fixed window exponentiations.
+ */
+template<ttmath::uint Limbs>
+static void testWindows(Key<Limbs> &key){
+    for (size_t i = 0; i < key.M.size(); i++) {
+        check(key.rsa.template sign<SLIDING_WINDOW>(key.M[i]) == key.expected[i],
+              "SLIDING_WINDOW, %ld bits, message %d", key.keyBits, int(i));
+        check(key.rsa.template sign<FIXED_WINDOW>(key.M[i]) == key.expected[i], "FIXED_WINDOW, %ld bits, message %d",
+              key.keyBits, int(i));
+    }
+}
+
+/*
+ * The Montgomery ladder, and the swap it is built on.
+ */
+template<ttmath::uint Limbs>
+static void testLadder(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    num a = key.M[3], b = key.M[4];
+    RsaN::ConditionalSwap(a, b, 0);
+    check(a == key.M[3] && b == key.M[4], "ConditionalSwap with 0 swapped, %ld bits", key.keyBits);
+    RsaN::ConditionalSwap(a, b, 1);
+    check(a == key.M[4] && b == key.M[3], "ConditionalSwap with 1 did not swap, %ld bits", key.keyBits);
+    for (size_t i = 0; i < key.M.size(); i++) {
+        check(key.rsa.template sign<MONTGOMERY_LADDER>(key.M[i]) == key.expected[i],
+              "MONTGOMERY_LADDER, %ld bits, message %d", key.keyBits, int(i));
+    }
+}
+
+/*
+ * Karatsuba multiplication and squaring, and the dedicated squaring,
+ * against the schoolbook multiplication.
+ */
+template<ttmath::uint Limbs>
+static void testMultiplication(Xoshiro256 &rng){
+    typedef ttmath::UInt<Limbs> num;
+    typedef ttmath::UInt<2*Limbs> numWide;
+    num top;
+    top.SetMax();
+    for (int i = 0; i < 20; i++) {
+        num a = bigrand(top, rng), b = bigrand(top, rng);
+        if (i == 0) {
+            a.SetMax();
+            b.SetMax();
+        }
+        numWide expected, product, square, squareExpected;
+        a.MulBig(b, expected, 2);
+        a.MulBig(b, product, 3);
+        check(product == expected, "Mul3Big != Mul2Big, %u limbs", unsigned(Limbs));
+        a.MulBig(b, product);
+        check(product == expected, "MulFastestBig != Mul2Big, %u limbs", unsigned(Limbs));
+        a.MulBig(a, squareExpected, 2);
+        a.SqrBig(square, 2);
+        check(square == squareExpected, "Sqr2Big != Mul2Big, %u limbs", unsigned(Limbs));
+        a.SqrBig(square, 3);
+        check(square == squareExpected, "Sqr3Big != Mul2Big, %u limbs", unsigned(Limbs));
+        a.SqrBig(square);
+        check(square == squareExpected, "SqrFastestBig != Mul2Big, %u limbs", unsigned(Limbs));
+    }
+}
+
+/*
+ * Expected data.csv of a dataset, as csv writes it. The min and mad are
+ * duration - 7 and 3, the client columns duration / 2 and i % 64.
+ */
+template<ttmath::uint Limbs>
+static std::string expectedCsv(const ttmath::UInt<Limbs> &n, const ttmath::UInt<Limbs> &e,
+                               const std::vector<ttmath::UInt<Limbs> > &M, const std::vector<ttmath::UInt<Limbs> > &S,
+                               const std::vector<int64_t> &durations, bool aggregates, bool client){
+    std::ostringstream csv;
+    csv << "N,E\n" << n << "," << e << "\n";
+    csv << (aggregates ? "message,signature,duration,min,mad" : "message,signature,duration");
+    csv << (client ? ",server_duration,inflight\n" : "\n");
+    for (size_t i = 0; i < M.size(); i++) {
+        csv << M[i] << "," << S[i] << "," << durations[i];
+        if (aggregates) {
+            csv << "," << durations[i] - 7 << "," << 3;
+        }
+        if (client) {
+            csv << "," << durations[i] / 2 << "," << i % 64;
+        }
+        csv << "\n";
+    }
+    return csv.str();
+}
+
+static std::string readFile(const char *path){
+    std::ifstream in(path);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+/*
+ * Writes a version 2 dataset with dataset::Writer, and a version 1 dataset
+ * byte by byte, and converts both back to CSV as csv --to-csv does.
+ * More rows than a Writer chunk, so the chunked reads and writes are crossed.
+ */
+static void testDataset(){
+    const ttmath::uint Limbs = RSA_LIMBS(512);
+    typedef ttmath::UInt<Limbs> num;
+    const uint32_t words = dataset::wordsFor<Limbs>();
+    const size_t rows = 5000;
+    Xoshiro256 rng(7);
+    num n = 1, e = 65537;
+    n.Rcl(500);
+    n.SubOne();
+    std::vector<num> M(rows), S(rows);
+    std::vector<int64_t> durations(rows);
+    for (size_t i = 0; i < rows; i++) {
+        M[i] = bigrand(n, rng);
+        S[i] = bigrand(n, rng);
+        durations[i] = int64_t(rng() >> 20);
+    }
+
+    for (int layout = 0; layout < 4; layout++) {
+        const int repeat = (layout & 1) ? 3 : 1;
+        const bool client = layout & 2;
+        dataset::Writer<Limbs> writer;
+        writer.setTimer(TIMER_STEADY, 1000000000, 20000);
+        writer.setRepeat(repeat, 0);
+        writer.setClient(client);
+        check(writer.open("test_v2.bin", n, e, 500, rows), "Writer::open");
+        for (size_t i = 0; i < rows; i++) {
+            const int64_t clients[dataset::ClientColumns] = {durations[i] / 2, int64_t(i % 64)};
+            writer.append(M[i], S[i], durations[i], durations[i] - 7, 3, NULL, clients);
+        }
+        check(writer.close(), "Writer::close");
+        check(dataset::toCsv("test_v2.bin", "test_v2.csv") == 0, "toCsv of a version 2 dataset");
+        check(readFile("test_v2.csv") == expectedCsv(n, e, M, S, durations, repeat > 1, client),
+              "version 2 dataset, repeat %d, %s client columns, does not round trip", repeat,
+              client ? "with" : "without");
+        remove("test_v2.bin");
+        remove("test_v2.csv");
+    }
+
+    // Version 1: a 64 byte header, N and E, then the three columns.
+    const uint64_t rowBytes = 8 * words;
+    const uint64_t messageOffset = dataset::align(dataset::FixedHeaderSizeV1 + 2 * rowBytes);
+    const uint64_t signatureOffset = dataset::align(messageOffset + rows * rowBytes);
+    const uint64_t durationOffset = dataset::align(signatureOffset + rows * rowBytes);
+    std::vector<unsigned char> file(durationOffset + rows * 8, 0);
+    memcpy(&file[0], dataset::Magic, sizeof(dataset::Magic));
+    dataset::put32(&file[8], 1);
+    dataset::put32(&file[12], words);
+    dataset::put32(&file[16], 500);
+    dataset::put32(&file[20], Limbs);
+    dataset::put64(&file[24], rows);
+    dataset::put64(&file[32], messageOffset);
+    dataset::put64(&file[40], signatureOffset);
+    dataset::put64(&file[48], durationOffset);
+    dataset::put64(&file[56], rows);
+    dataset::putNum(&file[dataset::FixedHeaderSizeV1], n);
+    dataset::putNum(&file[dataset::FixedHeaderSizeV1 + rowBytes], e);
+    for (size_t i = 0; i < rows; i++) {
+        dataset::putNum(&file[messageOffset + i * rowBytes], M[i]);
+        dataset::putNum(&file[signatureOffset + i * rowBytes], S[i]);
+        dataset::put64(&file[durationOffset + i * 8], uint64_t(durations[i]));
+    }
+    std::ofstream out("test_v1.bin", std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write((const char*)&file[0], file.size());
+    out.close();
+    check(dataset::toCsv("test_v1.bin", "test_v1.csv") == 0, "toCsv of a version 1 dataset");
+    check(readFile("test_v1.csv") == expectedCsv(n, e, M, S, durations, false, false), "version 1 dataset does not round trip");
+    remove("test_v1.bin");
+    remove("test_v1.csv");
+}
+
+/*
+ * signBatch against the signatures, and its subtraction counts against
+ * signCounted, MODEXP_SLEEP without the sleeps.
+ */
+template<ttmath::uint Limbs>
+static void testBatch(Key<Limbs> &key){
+    typedef typename Rsa<Limbs>::num num;
+    const size_t count = key.M.size();
+    std::vector<num> S(count);
+    std::vector<long> subtractions(count);
+    key.rsa.signBatch(&key.M[0], &S[0], count, &subtractions[0]);
+    for (size_t i = 0; i < count; i++) {
+        long counted;
+        check(key.rsa.signCounted(key.M[i], counted) == key.expected[i], "signCounted, %ld bits, message %d",
+              key.keyBits, int(i));
+        check(S[i] == key.expected[i], "signBatch, %ld bits, message %d", key.keyBits, int(i));
+        check(subtractions[i] == counted, "signBatch subtractions, %ld bits, message %d", key.keyBits, int(i));
+    }
+}
+
+/*
+ * Barrett multiplication against referenceMulMod, and the powering ladder
+ * on it.
+ */
+template<ttmath::uint Limbs>
+static void testBarrett(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    const typename RsaN::Barrett barrett(key.rsa.n);
+    for (size_t i = 0; i + 1 < key.M.size(); i++) {
+        const num &a = key.M[i], &b = key.M[i + 1];
+        check(RsaN::MulModBarrett(a, b, barrett) == referenceMulMod(a, b, key.rsa.n),
+              "MulModBarrett, %ld bits, messages %d and %d", key.keyBits, int(i), int(i + 1));
+    }
+    for (size_t i = 0; i < key.M.size(); i++) {
+        check(key.rsa.template sign<BARRETT_LADDER>(key.M[i]) == key.expected[i],
+              "BARRETT_LADDER, %ld bits, message %d", key.keyBits, int(i));
+    }
+}
+
+/*
+ * ModInverse for an odd and an even modulus, and NegInverseWord for the
+ * low word of n.
+ */
+template<ttmath::uint Limbs>
+static void testModInverse(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    const num moduli[2] = {key.rsa.n, (key.p - 1) * (key.q - 1)};
+    for (const num &m : moduli) {
+        for (int i = 0; i < 20; i++) {
+            num a = bigrand(m, key.rng);
+            if (i == 0) {
+                a = 1;
+            }
+            const num x = RsaN::ModInverse(a, m);
+            if (x != 0) {
+                check(x < m && referenceMulMod(a, x, m) == 1, "ModInverse(a, m)*a != 1, %ld bit m",
+                      RsaN::numBits(m));
+            }
+            else {
+                check(referenceGcd(a, m) != 1, "ModInverse found no inverse of a unit, %ld bit m",
+                      RsaN::numBits(m));
+            }
+        }
+    }
+    const ttmath::uint n0 = key.rsa.n.table[0];
+    check(ttmath::uint(n0 * RsaN::NegInverseWord(n0)) == ~ttmath::uint(0), "NegInverseWord(n)*n != -1, %ld bits",
+          key.keyBits);
+}
+
+/*
+ * Miller-Rabin on the primes of the key and on n, and the private exponent
+ * made from them.
+ */
+template<ttmath::uint Limbs>
+static void testPrimes(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::Context Context;
+    const typename RsaN::num e = 65537;
+    for (int base = 2; base < 6; base++) {
+        check(RsaN::MillerRabin(base, Context(key.p)), "MillerRabin(%d) says p is composite, %ld bits", base,
+              key.keyBits);
+        check(RsaN::MillerRabin(base, Context(key.q)), "MillerRabin(%d) says q is composite, %ld bits", base,
+              key.keyBits);
+    }
+    check(!RsaN::MillerRabin(2, Context(key.rsa.n)), "MillerRabin says n is prime, %ld bits", key.keyBits);
+    ThreadPool pool(1);
+    check(randomPrime<Limbs>(key.keyBits / 2, typename RsaN::num(4), pool, key.rng).IsZero(),
+          "randomPrime with an even e, %ld bits", key.keyBits);
+    check(referenceMulMod(e, key.rsa.d, (key.p - 1) * (key.q - 1)) == 1, "d is not the inverse of e, %ld bits",
+          key.keyBits);
+}
+
+/*
+ * The public exponentiation, verify, and encryption against decryption.
+ */
+template<ttmath::uint Limbs>
+static void testPublic(Key<Limbs> &key){
+    typedef Rsa<Limbs> RsaN;
+    typedef typename RsaN::num num;
+    const typename RsaN::Context ctx(key.rsa.n);
+    const ttmath::uint exponents[4] = {1, 3, 65537, ttmath::uint(key.rng()) | 1};
+    for (size_t i = 0; i < key.M.size(); i++) {
+        for (ttmath::uint e : exponents) {
+            check(RsaN::ModExpPublic(key.M[i], e, ctx) == referenceModExp(key.M[i], num(e), key.rsa.n),
+                  "ModExpPublic, %ld bits, message %d", key.keyBits, int(i));
+        }
+        check(key.rsa.verify(key.M[i], key.expected[i]), "verify, %ld bits, message %d", key.keyBits, int(i));
+        check(!key.rsa.verify(key.M[i], key.expected[(i + 1) % key.M.size()]),
+              "verify of a wrong signature, %ld bits, message %d",
+              key.keyBits, int(i));
+        check(key.rsa.decrypt(key.rsa.encrypt(key.M[i])) == key.M[i], "decrypt(encrypt), %ld bits, message %d",
+              key.keyBits, int(i));
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    (void)argc;
+    (void)argv;
+    Xoshiro256 rng(1);
+    testMultiplication<RSA_LIMBS(512)>(rng);
+    testMultiplication<RSA_LIMBS(1024)>(rng);
+    testMultiplication<RSA_LIMBS(2048)>(rng);
+    testMultiplication<RSA_LIMBS(4096)>(rng);
+
+    Keys keys;
+    FOR_EACH_KEY(keys, testMontgomery);
+    FOR_EACH_KEY(keys, testCrt);
+    FOR_EACH_KEY(keys, testWindows);
+    FOR_EACH_KEY(keys, testLadder);
+    FOR_EACH_KEY(keys, testBatch);
+    FOR_EACH_KEY(keys, testBarrett);
+    FOR_EACH_KEY(keys, testModInverse);
+    FOR_EACH_KEY(keys, testPrimes);
+    FOR_EACH_KEY(keys, testPublic);
+
+    testDataset();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
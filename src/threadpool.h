@@ -0,0 +1,109 @@
+//
+//  threadpool.h
+//  rsa
+//
+//  Fixed set of worker threads for data parallel loops.
+//
+
+#ifndef __rsa__threadpool__
+#define __rsa__threadpool__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * The threads are started once and reused by every parallelFor, so a loop
+ * that runs for every key bit does not pay for thread creation each time.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(size_t begin, size_t end, int worker)> RangeFunc;
+
+    /*
+     * Starts threads workers, or one per core if threads is 0.
+     */
+    explicit ThreadPool(int threads = 0)
+        :threads(threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()))),
+         job(NULL),count(0),generation(0),pending(0),stopping(false){
+        for (int i = 0; i < this->threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::work, this, i));
+        }
+    }
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    int size() const { return threads; }
+
+    /*
+     * Splits [0, count) into one contiguous range per worker, calls
+     * f(begin, end, worker) on every worker, and returns when all are done.
+     * worker is in [0, size()), so f can keep per worker results.
+     */
+    void parallelFor(size_t count, const RangeFunc &f){
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &f;
+        this->count = count;
+        pending = size();
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [this]{ return pending == 0; });
+        job = NULL;
+    }
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool &operator=(const ThreadPool&);
+
+    void work(int id){
+        uint64_t seen = 0;
+        for (;;) {
+            const RangeFunc *f;
+            size_t n;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                f = job;
+                n = count;
+            }
+            const size_t begin = n * id / threads, end = n * (id + 1) / threads;
+            (*f)(begin, end, id);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) {
+                    done.notify_one();
+                }
+            }
+        }
+    }
+
+    const int threads;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const RangeFunc *job;
+    size_t count;
+    uint64_t generation;
+    int pending;
+    bool stopping;
+};
+
+#endif /* defined(__rsa__threadpool__) */
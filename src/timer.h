@@ -0,0 +1,210 @@
+//
+//  timer.h
+//  rsa
+//
+//  Clocks for timing the signatures.
+//
+
+#ifndef __rsa__timer__
+#define __rsa__timer__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+/*
+ * Clock a Timer reads. The values are stored in the dataset header.
+ */
+enum TimerSource {
+    TIMER_SYSTEM = 0,   // std::chrono::system_clock, can be adjusted by NTP
+    TIMER_STEADY = 1,   // std::chrono::steady_clock
+    TIMER_TSC = 2,      // serialized rdtsc/rdtscp on x86
+    TIMER_CNTVCT = 3    // virtual counter cntvct_el0 on 64 bit ARM
+};
+
+/*
+ * Reads one clock, and converts tick differences to nanoseconds with the
+ * overhead of a start()/stop() pair subtracted.
+ * The frequency and the overhead are measured when the Timer is built.
+ *
+ * start() and stop() are inline and only switch on the source, so the
+ * timing loop pays for one well predicted branch on top of the clock read.
+ */
+class Timer {
+public:
+    TimerSource source;
+    double nsPerTick;       // length of a tick
+    double overheadTicks;   // ticks a start()/stop() pair takes with nothing in between
+
+    explicit Timer(TimerSource source = TIMER_STEADY):source(source),nsPerTick(1),overheadTicks(0){
+        calibrate();
+    }
+
+    /*
+     * True if the source can be read on this machine.
+     */
+    static bool available(TimerSource source){
+        switch (source) {
+            case TIMER_SYSTEM:
+            case TIMER_STEADY:
+                return true;
+            case TIMER_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+                return true;
+#else
+                return false;
+#endif
+            case TIMER_CNTVCT:
+#if defined(__aarch64__)
+                return true;
+#else
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    static const char *name(TimerSource source){
+        switch (source) {
+            case TIMER_SYSTEM: return "system";
+            case TIMER_STEADY: return "steady";
+            case TIMER_TSC: return "tsc";
+            case TIMER_CNTVCT: return "cntvct";
+        }
+        return "unknown";
+    }
+
+    /*
+     * Parses a name as printed by name(). Returns false if it is unknown.
+     */
+    static bool parse(const char *name, TimerSource &source){
+        const TimerSource all[] = {TIMER_SYSTEM, TIMER_STEADY, TIMER_TSC, TIMER_CNTVCT};
+        for (TimerSource s : all) {
+            if (!strcmp(name, Timer::name(s))) {
+                source = s;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Ticks per second.
+     */
+    uint64_t frequency() const {
+        return uint64_t(1e9 / nsPerTick + 0.5);
+    }
+
+    /*
+     * Timestamp before the timed code. The counter read can not be moved
+     * before earlier instructions, and later ones do not start before it.
+     */
+    inline uint64_t start() const {
+        switch (source) {
+            case TIMER_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+            {
+                uint32_t lo, hi;
+                asm volatile("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) :: "memory");
+                return (uint64_t(hi) << 32) | lo;
+            }
+#endif
+            case TIMER_CNTVCT:
+#if defined(__aarch64__)
+            {
+                uint64_t ticks;
+                asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks) :: "memory");
+                return ticks;
+            }
+#endif
+            case TIMER_STEADY:
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            case TIMER_SYSTEM:
+                break;
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /*
+     * Timestamp after the timed code. rdtscp waits for the timed code to
+     * finish, the lfence keeps later code from starting before the read.
+     */
+    inline uint64_t stop() const {
+        switch (source) {
+            case TIMER_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+            {
+                uint32_t lo, hi, aux;
+                asm volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux) :: "memory");
+                return (uint64_t(hi) << 32) | lo;
+            }
+#endif
+            case TIMER_CNTVCT:
+#if defined(__aarch64__)
+            {
+                uint64_t ticks;
+                asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(ticks) :: "memory");
+                return ticks;
+            }
+#endif
+            default:
+                return start();
+        }
+    }
+
+    /*
+     * Time between two timestamps, without the timer overhead. Never negative.
+     */
+    std::chrono::nanoseconds elapsed(uint64_t begin, uint64_t end) const {
+        double ticks = double(int64_t(end - begin)) - overheadTicks;
+        return std::chrono::nanoseconds(ticks > 0 ? int64_t(ticks * nsPerTick + 0.5) : 0);
+    }
+
+    /*
+     * The overhead in nanoseconds.
+     */
+    double overhead() const {
+        return overheadTicks * nsPerTick;
+    }
+
+private:
+    /*
+     * Measures the tick length against steady_clock, for the counters,
+     * and the overhead as the median of back to back start()/stop() pairs.
+     */
+    void calibrate(){
+        if (source == TIMER_CNTVCT) {
+#if defined(__aarch64__)
+            uint64_t hz;
+            asm volatile("mrs %0, cntfrq_el0" : "=r"(hz));
+            nsPerTick = hz ? 1e9 / double(hz) : 1;
+#endif
+        }
+        else if (source == TIMER_TSC) {
+            typedef std::chrono::steady_clock clock;
+            clock::time_point t0 = clock::now();
+            uint64_t c0 = start();
+            while (clock::now() - t0 < std::chrono::milliseconds(50)) {
+            }
+            uint64_t c1 = stop();
+            double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count());
+            nsPerTick = (c1 > c0) ? ns / double(c1 - c0) : 1;
+        }
+
+        const int pairs = 1001;
+        std::vector<uint64_t> samples(pairs);
+        for (int i = 0; i < pairs; i++) {
+            uint64_t begin = start();
+            samples[i] = stop() - begin;
+        }
+        std::nth_element(samples.begin(), samples.begin() + pairs / 2, samples.end());
+        overheadTicks = double(samples[pairs / 2]);
+    }
+};
+
+#endif /* defined(__rsa__timer__) */
@@ -0,0 +1,86 @@
+//
+//  tuning.h
+//  rsa
+//
+//  Karatsuba limits measured on the machine by ./bench --tune.
+//
+
+#ifndef __rsa__tuning__
+#define __rsa__tuning__
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lib/ttmath.h"
+
+/*
+ * The file bench --tune writes and the programs read at startup,
+ * in the working directory.
+ */
+const char DefaultTuningFile[] = "ttmath.tune";
+
+/*
+ * Sets ttmath's Karatsuba limits from a file written by saveTuning, and
+ * says so on log. Call before any thread multiplies. Returns false, and
+ * leaves the limits at the compiled in values, if there is no such file
+ * or it is not valid.
+ */
+inline bool loadTuning(const char *path = DefaultTuningFile, FILE *log = stdout){
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char line[256], key[64];
+    unsigned long value;
+    unsigned long multiplication = ttmath::KaratsubaMultiplicationFromSize();
+    unsigned long squaring = ttmath::KaratsubaSquaringFromSize();
+    unsigned long limbBits = TTMATH_BITS_PER_UINT;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "%63s %lu", key, &value) != 2) {
+            ok = false;
+        }
+        else if (!strcmp(key, "karatsuba_multiplication_from")) {
+            multiplication = value;
+        }
+        else if (!strcmp(key, "karatsuba_squaring_from")) {
+            squaring = value;
+        }
+        else if (!strcmp(key, "limb_bits")) {
+            limbBits = value;
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        fprintf(log, "Ignoring %s, it is not a tuning file\n", path);
+        return false;
+    }
+    if (limbBits != TTMATH_BITS_PER_UINT) {
+        fprintf(log, "Ignoring %s, it was measured with %lu bit limbs\n", path, limbBits);
+        return false;
+    }
+    ttmath::KaratsubaMultiplicationFromSize() = ttmath::uint(multiplication);
+    ttmath::KaratsubaSquaringFromSize() = ttmath::uint(squaring);
+    fprintf(log, "Karatsuba limits from %s: multiplication %lu, squaring %lu limbs\n", path, multiplication, squaring);
+    return true;
+}
+
+/*
+ * Writes the current Karatsuba limits to path, for loadTuning.
+ */
+inline bool saveTuning(const char *path = DefaultTuningFile){
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "# Karatsuba limits in limbs, written by ./bench --tune\n");
+    fprintf(f, "limb_bits %d\n", int(TTMATH_BITS_PER_UINT));
+    fprintf(f, "karatsuba_multiplication_from %lu\n", (unsigned long)ttmath::KaratsubaMultiplicationFromSize());
+    fprintf(f, "karatsuba_squaring_from %lu\n", (unsigned long)ttmath::KaratsubaSquaringFromSize());
+    return fclose(f) == 0;
+}
+
+#endif /* defined(__rsa__tuning__) */